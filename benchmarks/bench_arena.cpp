@@ -0,0 +1,84 @@
+#include <benchmark/benchmark.h>
+
+#include "../include/parallel_for.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+static void DoSetup(const benchmark::State &state) {
+  InitParallel(GetNumThreads());
+}
+
+static void Spin(size_t iters) {
+  for (size_t i = 0; i != iters; ++i) {
+    CpuRelax();
+  }
+}
+
+// Two subsystems share the machine: a background thread keeps submitting
+// long loops, the benchmark thread runs short ones and measures their
+// latency. With "isolated" = 0 both submit to one arena of all threads,
+// otherwise each subsystem gets its own arena with half of the cpus, so long
+// loops can't swamp the queues of short ones.
+static void BM_ArenaBench(benchmark::State &state) {
+  const bool isolated = state.range(0) != 0;
+  const size_t threads = GetNumThreads();
+  const auto &allCpus = Topology::Get().Cpus;
+  std::vector<CpuInfo> cpus(allCpus.begin(),
+                            allCpus.begin() + std::min(threads, allCpus.size()));
+  auto half = std::max(threads / 2, size_t{1});
+  auto middle = cpus.begin() + std::min(half, cpus.size());
+
+  std::unique_ptr<EigenArena> shared;
+  std::unique_ptr<EigenArena> longArena;
+  std::unique_ptr<EigenArena> shortArena;
+  if (isolated) {
+    longArena = std::make_unique<EigenArena>(
+        half, std::vector<CpuInfo>(cpus.begin(), middle));
+    shortArena = std::make_unique<EigenArena>(
+        std::max(threads - half, size_t{1}),
+        std::vector<CpuInfo>(middle, cpus.end()));
+  } else {
+    shared = std::make_unique<EigenArena>(threads, cpus);
+  }
+  auto &longLoops = isolated ? *longArena : *shared;
+  auto &shortLoops = isolated ? *shortArena : *shared;
+
+  std::atomic<bool> stop{false};
+  std::thread background([&]() {
+    while (!stop.load(std::memory_order_relaxed)) {
+      EigenPartitioner::ParallelFor(longLoops, 0, 64 * threads,
+                                    [](size_t) { Spin(1 << 16); });
+    }
+  });
+
+  double latencyNs = 0;
+  for (auto _ : state) {
+    auto start = std::chrono::steady_clock::now();
+    EigenPartitioner::ParallelFor(shortLoops, 0, threads,
+                                  [](size_t) { Spin(1 << 8); });
+    latencyNs += std::chrono::duration<double, std::nano>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  }
+  state.counters["latency_ns"] =
+      benchmark::Counter(latencyNs, benchmark::Counter::kAvgIterations);
+
+  stop = true;
+  background.join();
+}
+
+BENCHMARK(BM_ArenaBench)
+    ->Name("Arena_" + GetParallelMode())
+    ->Setup(DoSetup)
+    ->UseRealTime()
+    ->ArgName("isolated")
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
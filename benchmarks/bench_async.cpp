@@ -0,0 +1,86 @@
+#include <benchmark/benchmark.h>
+
+#include "../include/parallel_for.h"
+
+#include <atomic>
+#include <vector>
+
+static void DoSetup(const benchmark::State &state) {
+  InitParallel(GetNumThreads());
+}
+
+static constexpr size_t REQUESTS = 1 << 10;
+
+static void Stage(std::atomic<size_t> &done) {
+  for (size_t j = 0; j != 256; ++j) {
+    CpuRelax();
+  }
+  done.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Every stage of a request is a separate task, the request waits for it.
+static void RunBlocking(std::atomic<size_t> &done, size_t stages) {
+  for (size_t s = 0; s != stages; ++s) {
+    EigenPartitioner::ParallelDo([&]() { Stage(done); }, []() {});
+  }
+}
+
+static void RunRequestsBlocking(std::atomic<size_t> &done, size_t stages,
+                                size_t from, size_t to) {
+  if (to - from == 1) {
+    RunBlocking(done, stages);
+    return;
+  }
+  auto mid = from + (to - from) / 2;
+  EigenPartitioner::ParallelDo(
+      [&]() { RunRequestsBlocking(done, stages, mid, to); },
+      [&]() { RunRequestsBlocking(done, stages, from, mid); });
+}
+
+// Every stage of a request is resumed as a task, nothing waits for it.
+static EigenAsync::Task<> RunAsync(std::atomic<size_t> &done, size_t stages) {
+  for (size_t s = 0; s != stages; ++s) {
+    co_await EigenPoolWrapper{}.schedule();
+    Stage(done);
+  }
+}
+
+static EigenAsync::Task<> RunRequestsAsync(std::atomic<size_t> &done,
+                                           size_t stages) {
+  std::vector<EigenAsync::Task<>> requests;
+  requests.reserve(REQUESTS);
+  for (size_t i = 0; i != REQUESTS; ++i) {
+    requests.push_back(RunAsync(done, stages));
+  }
+  co_await EigenAsync::when_all(std::move(requests));
+}
+
+// REQUESTS chains of "stages" short stages, "async" = 1 runs them as
+// coroutines, 0 with blocking ParallelDo.
+static void BM_AsyncBench(benchmark::State &state) {
+  const size_t stages = state.range(0);
+  const bool async = state.range(1) != 0;
+  for (auto _ : state) {
+    std::atomic<size_t> done{0};
+    if (async) {
+      EigenAsync::sync_wait(RunRequestsAsync(done, stages));
+    } else {
+      RunRequestsBlocking(done, stages, 0, REQUESTS);
+    }
+    if (done != REQUESTS * stages) {
+      state.SkipWithError("lost stages");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * REQUESTS);
+}
+
+BENCHMARK(BM_AsyncBench)
+    ->Name("Async_" + GetParallelMode())
+    ->Setup(DoSetup)
+    ->UseRealTime()
+    ->ArgNames({"stages", "async"})
+    ->ArgsProduct({{1, 4, 16}, {0, 1}})
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,59 @@
+#include <benchmark/benchmark.h>
+
+#include "../include/parallel_for.h"
+
+#include <atomic>
+
+static void DoSetup(const benchmark::State &state) {
+  InitParallel(GetNumThreads());
+}
+
+static const size_t SEARCH_SIZE = GetNumThreads() << 16;
+
+static bool IsMatch(size_t i, size_t match) {
+  for (size_t j = 0; j != 64; ++j) {
+    CpuRelax();
+  }
+  return i >= match;
+}
+
+// Time to find the first index matching a predicate, the match is at
+// "match_permille" of the range. With "cancel" = 0 the whole range is
+// searched by ParallelFor, otherwise ParallelFindFirst cancels iterations
+// after the match.
+static void BM_FindBench(benchmark::State &state) {
+  const size_t match = SEARCH_SIZE * state.range(0) / 1000;
+  const bool cancel = state.range(1) != 0;
+  for (auto _ : state) {
+    size_t found;
+    if (cancel) {
+      found = EigenPartitioner::ParallelFindFirst(
+          0, SEARCH_SIZE, [match](size_t i) { return IsMatch(i, match); });
+    } else {
+      std::atomic<size_t> first{SEARCH_SIZE};
+      EigenPartitioner::ParallelFor(0, SEARCH_SIZE, [&](size_t i) {
+        if (IsMatch(i, match)) {
+          auto current = first.load(std::memory_order_relaxed);
+          while (i < current && !first.compare_exchange_weak(current, i)) {
+          }
+        }
+      });
+      found = first.load();
+    }
+    if (found != match) {
+      state.SkipWithError("wrong answer");
+      break;
+    }
+    benchmark::DoNotOptimize(found);
+  }
+}
+
+BENCHMARK(BM_FindBench)
+    ->Name("Find_" + GetParallelMode())
+    ->Setup(DoSetup)
+    ->UseRealTime()
+    ->ArgNames({"match_permille", "cancel"})
+    ->ArgsProduct({{1, 100, 500, 999}, {0, 1}})
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,129 @@
+#include <benchmark/benchmark.h>
+
+#include "../include/parallel_for.h"
+
+#include <utility>
+#include <vector>
+
+static void DoSetup(const benchmark::State &state) {
+  InitParallel(GetNumThreads());
+}
+
+// Wavefront over a square grid of blocks: block (i, j) runs after (i - 1, j)
+// and (i, j - 1). The graph is built once and run on every iteration, on the
+// Eigen pool rows of blocks are hinted to threads.
+class Wavefront {
+public:
+  Wavefront(size_t blocks, size_t blockSize)
+      : Blocks_(blocks), BlockSize_(blockSize),
+        Data_(blocks * blocks * blockSize) {
+    std::vector<NodeId> nodes;
+    for (size_t i = 0; i != Blocks_; ++i) {
+      for (size_t j = 0; j != Blocks_; ++j) {
+        auto node = AddNode([this, i, j]() { Compute(i, j); },
+                            i * GetNumThreads() / Blocks_);
+        if (i != 0) {
+          Precede(nodes[(i - 1) * Blocks_ + j], node);
+        }
+        if (j != 0) {
+          Precede(nodes[i * Blocks_ + j - 1], node);
+        }
+        nodes.push_back(node);
+      }
+    }
+  }
+
+  void Run() {
+#if defined(EIGEN_MODE)
+    Graph_.Run();
+#elif defined(TASKFLOW_MODE)
+    tfExecutor().run(Graph_).wait();
+#endif
+  }
+
+  void RunSerial() {
+    for (size_t i = 0; i != Blocks_; ++i) {
+      for (size_t j = 0; j != Blocks_; ++j) {
+        Compute(i, j);
+      }
+    }
+  }
+
+  const std::vector<double> &Data() const { return Data_; }
+
+private:
+#if defined(EIGEN_MODE)
+  using NodeId = EigenPartitioner::TaskGraph::NodeId;
+
+  template <typename F> NodeId AddNode(F &&func, size_t threadHint) {
+    return Graph_.AddNode(std::forward<F>(func), threadHint);
+  }
+
+  void Precede(NodeId from, NodeId to) { Graph_.AddEdge(from, to); }
+
+  EigenPartitioner::TaskGraph Graph_;
+#elif defined(TASKFLOW_MODE)
+  using NodeId = tf::Task;
+
+  template <typename F> NodeId AddNode(F &&func, size_t /*threadHint*/) {
+    return Graph_.emplace(std::forward<F>(func));
+  }
+
+  void Precede(NodeId from, NodeId to) { from.precede(to); }
+
+  tf::Taskflow Graph_;
+#else
+  static_assert(false, "bench_graph supports EIGEN_MODE and TASKFLOW_MODE");
+#endif
+
+  double *Block(size_t i, size_t j) {
+    return Data_.data() + (i * Blocks_ + j) * BlockSize_;
+  }
+
+  void Compute(size_t i, size_t j) {
+    auto *out = Block(i, j);
+    const auto *up = i != 0 ? Block(i - 1, j) : nullptr;
+    const auto *left = j != 0 ? Block(i, j - 1) : nullptr;
+    for (size_t k = 0; k != BlockSize_; ++k) {
+      double sum = 1;
+      if (up) {
+        sum += 0.5 * up[k];
+      }
+      if (left) {
+        sum += 0.5 * left[k];
+      }
+      out[k] = sum;
+    }
+  }
+
+  size_t Blocks_;
+  size_t BlockSize_;
+  std::vector<double> Data_;
+};
+
+// "blocks" is the side of the grid, "work" the number of elements a block
+// computes.
+static void BM_GraphBench(benchmark::State &state) {
+  const size_t blocks = state.range(0);
+  const size_t work = state.range(1);
+  Wavefront expected(blocks, work);
+  expected.RunSerial();
+  Wavefront graph(blocks, work);
+  for (auto _ : state) {
+    graph.Run();
+  }
+  // every block depends on all blocks above and to the left of it
+  if (graph.Data() != expected.Data()) {
+    state.SkipWithError("wrong wavefront result");
+  }
+}
+
+BENCHMARK(BM_GraphBench)
+    ->Name("Graph_" + GetParallelMode())
+    ->Setup(DoSetup)
+    ->UseRealTime()
+    ->ArgNames({"blocks", "work"})
+    ->ArgsProduct({{8, 32, 64}, {64, 1024}})
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
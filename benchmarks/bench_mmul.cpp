@@ -13,16 +13,22 @@ static auto left = SPMV::GenDenseMatrix<double>(MATRIX_SIZE_HERE, MATRIX_SIZE_HE
 static auto right = SPMV::GenDenseMatrix<double>(MATRIX_SIZE_HERE, MATRIX_SIZE_HERE);
 static auto out = SPMV::DenseMatrix<double>(MATRIX_SIZE_HERE, MATRIX_SIZE_HERE);
 
-static void BM_MatrixMul(benchmark::State &state) {
+// "nested" = 1 nests a ParallelFor over columns into one over rows instead
+// of a single ParallelFor2D over tiles
+static void BM_MatrixMul(benchmark::State &state, bool nested) {
   // cache data for all iterations
   for (auto _ : state) {
-    SPMV::MultiplyMatrix(left, right, out);
+    if (nested) {
+      SPMV::MultiplyMatrixNested(left, right, out);
+    } else {
+      SPMV::MultiplyMatrix(left, right, out);
+    }
   }
 }
 
 
 #ifndef TASKFLOW_MODE
-BENCHMARK(BM_MatrixMul)
+BENCHMARK_CAPTURE(BM_MatrixMul, tiled, false)
     ->Name("MatrixMul_Latency_" + GetParallelMode())
     ->Setup(DoSetup)
     ->UseRealTime()
@@ -30,7 +36,15 @@ BENCHMARK(BM_MatrixMul)
     ->Unit(benchmark::kMicrosecond)
     ->MinTime(2);
 
-BENCHMARK(BM_MatrixMul)
+BENCHMARK_CAPTURE(BM_MatrixMul, nested, true)
+    ->Name("MatrixMulNested_Latency_" + GetParallelMode())
+    ->Setup(DoSetup)
+    ->UseRealTime()
+    ->MeasureProcessCPUTime()
+    ->Unit(benchmark::kMicrosecond)
+    ->MinTime(2);
+
+BENCHMARK_CAPTURE(BM_MatrixMul, tiled, false)
     ->Name("MatrixMul_Throughput_" + GetParallelMode())
     ->Setup(DoSetup)
     ->UseRealTime()
@@ -38,6 +52,14 @@ BENCHMARK(BM_MatrixMul)
     ->Unit(benchmark::kMicrosecond)
     ->MinTime(2);
 
+BENCHMARK_CAPTURE(BM_MatrixMul, nested, true)
+    ->Name("MatrixMulNested_Throughput_" + GetParallelMode())
+    ->Setup(DoSetup)
+    ->UseRealTime()
+    ->MeasureProcessCPUTime()
+    ->Unit(benchmark::kMicrosecond)
+    ->MinTime(2);
+
 BENCHMARK_MAIN();
 #else
 int main() {}
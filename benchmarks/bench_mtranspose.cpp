@@ -9,20 +9,26 @@ static void DoSetup(const benchmark::State &state) {
   InitParallel(GetNumThreads());
 }
 
-static void BM_MatrixTranspose(benchmark::State &state) {
+// "nested" = 1 nests loops over blocks of columns into one over blocks of
+// rows instead of a single ParallelFor2D over tiles
+static void BM_MatrixTranspose(benchmark::State &state, bool nested) {
   static auto matrix = SPMV::GenDenseMatrix<double>(MATRIX_SIZE, MATRIX_SIZE);
   static auto out = SPMV::DenseMatrix<double>(MATRIX_SIZE, MATRIX_SIZE);
   benchmark::DoNotOptimize(matrix);
   benchmark::DoNotOptimize(out);
   for (auto _ : state) {
-    SPMV::TransposeMatrix(matrix, out);
+    if (nested) {
+      SPMV::TransposeMatrixNested(matrix, out);
+    } else {
+      SPMV::TransposeMatrix(matrix, out);
+    }
     benchmark::ClobberMemory();
   }
 }
 
 
 #ifndef TASKFLOW_MODE
-BENCHMARK(BM_MatrixTranspose)
+BENCHMARK_CAPTURE(BM_MatrixTranspose, tiled, false)
     ->Name("MatrixTranspose_Latency_" + GetParallelMode())
     ->Setup(DoSetup)
     ->UseRealTime()
@@ -30,7 +36,15 @@ BENCHMARK(BM_MatrixTranspose)
     ->Unit(benchmark::kMicrosecond)
     ->MinTime(2);
 
-BENCHMARK(BM_MatrixTranspose)
+BENCHMARK_CAPTURE(BM_MatrixTranspose, nested, true)
+    ->Name("MatrixTransposeNested_Latency_" + GetParallelMode())
+    ->Setup(DoSetup)
+    ->UseRealTime()
+    ->MeasureProcessCPUTime()
+    ->Unit(benchmark::kMicrosecond)
+    ->MinTime(2);
+
+BENCHMARK_CAPTURE(BM_MatrixTranspose, tiled, false)
     ->Name("MatrixTranspose_Throughput_" + GetParallelMode())
     ->Setup(DoSetup)
     ->UseRealTime()
@@ -38,6 +52,14 @@ BENCHMARK(BM_MatrixTranspose)
     ->Unit(benchmark::kMicrosecond)
     ->MinTime(2);
 
+BENCHMARK_CAPTURE(BM_MatrixTranspose, nested, true)
+    ->Name("MatrixTransposeNested_Throughput_" + GetParallelMode())
+    ->Setup(DoSetup)
+    ->UseRealTime()
+    ->MeasureProcessCPUTime()
+    ->Unit(benchmark::kMicrosecond)
+    ->MinTime(2);
+
 
 BENCHMARK_MAIN();
 #else
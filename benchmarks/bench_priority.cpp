@@ -0,0 +1,68 @@
+#include <benchmark/benchmark.h>
+
+#include "../include/parallel_for.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+static void DoSetup(const benchmark::State &state) {
+  InitParallel(GetNumThreads());
+}
+
+static void Spin(size_t iters) {
+  for (size_t i = 0; i != iters; ++i) {
+    CpuRelax();
+  }
+}
+
+// A background thread keeps the pool busy with big loops of small balancing
+// tasks, the benchmark thread runs short loops of the given priority and
+// reports percentiles of their latency.
+static void BM_PriorityBench(benchmark::State &state) {
+  const auto priority =
+      state.range(0) ? Eigen::Priority::HIGH : Eigen::Priority::NORMAL;
+  const size_t threads = GetNumThreads();
+
+  std::atomic<bool> stop{false};
+  std::thread background([&]() {
+    while (!stop.load(std::memory_order_relaxed)) {
+      EigenPartitioner::ParallelFor(0, 1024 * threads,
+                                    [](size_t) { Spin(1 << 12); });
+    }
+  });
+
+  std::vector<double> latencies;
+  for (auto _ : state) {
+    auto start = std::chrono::steady_clock::now();
+    EigenPartitioner::ParallelFor(
+        0, threads, [](size_t) { Spin(1 << 8); }, 1, priority);
+    latencies.push_back(std::chrono::duration<double, std::micro>(
+                            std::chrono::steady_clock::now() - start)
+                            .count());
+  }
+  stop = true;
+  background.join();
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) {
+    return latencies[std::min(latencies.size() - 1,
+                              static_cast<size_t>(p * latencies.size()))];
+  };
+  state.counters["p50_us"] = percentile(0.5);
+  state.counters["p99_us"] = percentile(0.99);
+  state.counters["max_us"] = latencies.back();
+}
+
+BENCHMARK(BM_PriorityBench)
+    ->Name("Priority_" + GetParallelMode())
+    ->Setup(DoSetup)
+    ->UseRealTime()
+    ->ArgName("high")
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,61 @@
+#include <benchmark/benchmark.h>
+
+#include "../include/eigen/chase_lev_deque.h"
+#include "../include/eigen/run_queue.h"
+
+#include <array>
+#include <memory>
+
+// Steal storm on a single victim queue: thread 0 is the owner that keeps
+// pushing and popping tasks from the front, all other threads are thieves
+// that hammer the back of the same queue.
+
+namespace {
+constexpr unsigned QueueSize = 1024;
+constexpr size_t Batch = 64;
+
+std::array<int, Batch> Items;
+} // namespace
+
+template <typename Queue> static void BM_QueueSteal(benchmark::State &state) {
+  static std::unique_ptr<Queue> queue;
+  if (state.thread_index() == 0) {
+    queue = std::make_unique<Queue>();
+  }
+  size_t taken = 0;
+  if (state.thread_index() == 0) {
+    for (auto _ : state) {
+      for (auto &item : Items) {
+        queue->PushFront(&item);
+      }
+      while (queue->PopFront()) {
+        ++taken;
+      }
+    }
+  } else {
+    for (auto _ : state) {
+      if (queue->PopBack()) {
+        ++taken;
+      }
+    }
+  }
+  state.counters["taken"] =
+      benchmark::Counter(taken, benchmark::Counter::kIsRate);
+  if (state.thread_index() == 0) {
+    queue->Flush();
+  }
+}
+
+BENCHMARK_TEMPLATE(BM_QueueSteal, Eigen::RunQueue<int *, QueueSize>)
+    ->Name("QueueSteal_RunQueue")
+    ->ThreadRange(1, 64)
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_TEMPLATE(BM_QueueSteal, Eigen::ChaseLevDeque<int *, QueueSize>)
+    ->Name("QueueSteal_ChaseLev")
+    ->ThreadRange(1, 64)
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -3,41 +3,68 @@
 
 #include "../include/parallel_for.h"
 
+#include <cfloat>
+#include <cmath>
+#include <functional>
+#include <map>
+
 static const size_t MAX_SIZE = (GetNumThreads() << 19);
-// static constexpr size_t BLOCK_SIZE = 1 << 14;
-// static constexpr size_t blocks = (MAX_SIZE + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
 static void DoSetup(const benchmark::State &state) {
   InitParallel(GetNumThreads());
 }
 
-void __attribute__((noinline)) reduceImpl(std::vector<double> &data, size_t blocks, size_t blockSize) {
-  ParallelFor(0, blocks, [&](size_t i) {
-    static thread_local double res = 0;
-    benchmark::DoNotOptimize(res);
-    double sum = 0;
-    auto start = i * blockSize;
-    auto end = std::min(start + blockSize, MAX_SIZE);
-    for (size_t j = start; j < end; ++j) {
-      sum += data[j];
-    }
-    res += sum;
-  });
+static const std::vector<double> &GetData() {
+  static auto data = SPMV::GenVector<double>(MAX_SIZE);
+  return data;
 }
 
-static void BM_ReduceBench(benchmark::State &state) {
-  static auto data = SPMV::GenVector<double>(MAX_SIZE);
+double __attribute__((noinline))
+reduceImpl(const std::vector<double> &data, size_t blockSize, ReduceMode mode) {
+  return ParallelReduce(
+      0, data.size(), 0.0,
+      [&](size_t from, size_t to) {
+        double sum = 0;
+        for (size_t j = from; j < to; ++j) {
+          sum += data[j];
+        }
+        return sum;
+      },
+      std::plus<>{}, blockSize, mode);
+}
+
+static void BM_ReduceBench(benchmark::State &state, ReduceMode mode) {
+  auto &data = GetData();
   benchmark::DoNotOptimize(data);
   auto blockSize = state.range(0);
-  auto blocks = (MAX_SIZE + blockSize - 1) / blockSize;
+  double result = 0;
   for (auto _ : state) {
-    reduceImpl(data, blocks, blockSize);
+    result = reduceImpl(data, blockSize, mode);
+    benchmark::DoNotOptimize(result);
     benchmark::ClobberMemory();
   }
-}
 
+  // any summation order is within n * eps * sum |x| of the serial sum
+  double expected = 0;
+  double absSum = 0;
+  for (auto x : data) {
+    expected += x;
+    absSum += std::abs(x);
+  }
+  if (std::abs(result - expected) > data.size() * DBL_EPSILON * absSum) {
+    state.SkipWithError("wrong reduction result");
+  }
+  if (mode == ReduceMode::DETERMINISTIC) {
+    // blocks depend on the block size only, so do the results
+    static std::map<size_t, double> firstResults;
+    auto first = firstResults.emplace(blockSize, result).first;
+    if (first->second != result) {
+      state.SkipWithError("deterministic reduction result differs");
+    }
+  }
+}
 
-BENCHMARK(BM_ReduceBench)
+BENCHMARK_CAPTURE(BM_ReduceBench, fast, ReduceMode::FAST)
     ->Name("Reduce_Latency_" + GetParallelMode())
     ->Setup(DoSetup)
     ->UseRealTime()
@@ -48,7 +75,7 @@ BENCHMARK(BM_ReduceBench)
     ->Unit(benchmark::kMicrosecond)
     ->MinTime(2);
 
-BENCHMARK(BM_ReduceBench)
+BENCHMARK_CAPTURE(BM_ReduceBench, fast, ReduceMode::FAST)
     ->Name("Reduce_Throughput_" + GetParallelMode())
     ->Setup(DoSetup)
     ->UseRealTime()
@@ -59,7 +86,16 @@ BENCHMARK(BM_ReduceBench)
     ->Unit(benchmark::kMicrosecond)
     ->MinTime(2);
 
-
-BENCHMARK_MAIN();
+BENCHMARK_CAPTURE(BM_ReduceBench, deterministic, ReduceMode::DETERMINISTIC)
+    ->Name("ReduceDeterministic_Latency_" + GetParallelMode())
+    ->Setup(DoSetup)
+    ->UseRealTime()
+    ->MeasureProcessCPUTime()
+    ->ArgName("blocksize")
+    ->RangeMultiplier(4)
+    ->Range(1 << 12, 1 << 17)
+    ->Unit(benchmark::kMicrosecond)
+    ->MinTime(2);
 
 
+BENCHMARK_MAIN();
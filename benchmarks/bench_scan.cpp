@@ -19,6 +19,18 @@ static void BM_ScanBench(benchmark::State &state) {
   }
 }
 
+// same sizes as Scan plus a few elements, ParallelScan isn't limited to 2^k
+static void BM_ParallelScanBench(benchmark::State &state) {
+  static auto data = SPMV::GenVector<double>((1 << SIZE_POW) + 3);
+  static std::vector<double> out(data.size());
+  benchmark::DoNotOptimize(data);
+  benchmark::DoNotOptimize(out);
+  for (auto _ : state) {
+    Scan::ParallelScan(data.data(), out.data(), (1 << state.range(0)) + 3);
+    benchmark::ClobberMemory();
+  }
+}
+
 
 BENCHMARK(BM_ScanBench)
     ->Name("Scan_Latency_" + GetParallelMode())
@@ -40,6 +52,26 @@ BENCHMARK(BM_ScanBench)
     ->Unit(benchmark::kMicrosecond)
     ->MinTime(2);
 
+BENCHMARK(BM_ParallelScanBench)
+    ->Name("ParallelScan_Latency_" + GetParallelMode())
+    ->Setup(DoSetup)
+    ->UseRealTime()
+    ->MeasureProcessCPUTime()
+    ->ArgName("SizePow")
+    ->DenseRange(10, SIZE_POW, 2)
+    ->Unit(benchmark::kMicrosecond)
+    ->MinTime(2);
+
+BENCHMARK(BM_ParallelScanBench)
+    ->Name("ParallelScan_Throughput_" + GetParallelMode())
+    ->Setup(DoSetup)
+    ->UseRealTime()
+    ->MeasureProcessCPUTime()
+    ->ArgName("SizePow")
+    ->DenseRange(10, SIZE_POW, 2)
+    ->Unit(benchmark::kMicrosecond)
+    ->MinTime(2);
+
 
 BENCHMARK_MAIN();
 
@@ -0,0 +1,112 @@
+#include <benchmark/benchmark.h>
+
+#include "../include/benchmarks/spmv.h"
+#include "../include/parallel_for.h"
+
+#include <algorithm>
+#include <vector>
+
+static void DoSetup(const benchmark::State &state) {
+  InitParallel(GetNumThreads());
+}
+
+enum Fork { SERIAL_FORK, PARALLEL_DO, SPAWN };
+
+template <Fork Mode, typename F1, typename F2>
+static void ForkJoin(F1 &&fst, F2 &&sec) {
+  if constexpr (Mode == SERIAL_FORK) {
+    fst();
+    sec();
+  } else if constexpr (Mode == PARALLEL_DO) {
+    EigenPartitioner::ParallelDo(fst, sec);
+  } else {
+    EigenPartitioner::Spawn(fst, sec);
+  }
+}
+
+template <Fork Mode> static size_t Fib(size_t n) {
+  if (n < 2) {
+    return n;
+  }
+  size_t x = 0;
+  size_t y = 0;
+  ForkJoin<Mode>([&]() { x = Fib<Mode>(n - 1); },
+                 [&]() { y = Fib<Mode>(n - 2); });
+  return x + y;
+}
+
+template <Fork Mode> static void QuickSort(double *from, double *to) {
+  if (to - from <= 32) {
+    std::sort(from, to);
+    return;
+  }
+  auto pivot = from[(to - from) / 2];
+  auto mid1 = std::partition(from, to, [pivot](double x) { return x < pivot; });
+  auto mid2 =
+      std::partition(mid1, to, [pivot](double x) { return !(pivot < x); });
+  ForkJoin<Mode>([&]() { QuickSort<Mode>(from, mid1); },
+                 [&]() { QuickSort<Mode>(mid2, to); });
+}
+
+static constexpr size_t FIB_N = 30;
+static const size_t SORT_SIZE = GetNumThreads() << 18;
+
+// Recursion with a fork at every call: "fork" = 0 runs both branches
+// serially, 1 with ParallelDo and 2 with Spawn.
+template <Fork Mode> static size_t RunFib() { return Fib<Mode>(FIB_N); }
+
+static void BM_FibBench(benchmark::State &state) {
+  auto fork = state.range(0);
+  for (auto _ : state) {
+    // run on a worker, Spawn falls back to ParallelDo elsewhere
+    size_t result = 0;
+    ParallelFor(0, 1, [&](size_t) {
+      result = fork == SERIAL_FORK   ? RunFib<SERIAL_FORK>()
+               : fork == PARALLEL_DO ? RunFib<PARALLEL_DO>()
+                                     : RunFib<SPAWN>();
+    });
+    if (result != 832040) {
+      state.SkipWithError("wrong answer");
+      break;
+    }
+  }
+}
+
+static void BM_QuickSortBench(benchmark::State &state) {
+  auto fork = state.range(0);
+  static const auto input = SPMV::GenVector<double>(SORT_SIZE);
+  std::vector<double> data;
+  for (auto _ : state) {
+    state.PauseTiming();
+    data = input;
+    state.ResumeTiming();
+    ParallelFor(0, 1, [&](size_t) {
+      auto from = data.data();
+      auto to = data.data() + data.size();
+      fork == SERIAL_FORK   ? QuickSort<SERIAL_FORK>(from, to)
+      : fork == PARALLEL_DO ? QuickSort<PARALLEL_DO>(from, to)
+                            : QuickSort<SPAWN>(from, to);
+    });
+  }
+  if (!std::is_sorted(data.begin(), data.end())) {
+    state.SkipWithError("not sorted");
+  }
+}
+
+BENCHMARK(BM_FibBench)
+    ->Name("Fib_" + GetParallelMode())
+    ->Setup(DoSetup)
+    ->UseRealTime()
+    ->ArgName("fork")
+    ->DenseRange(SERIAL_FORK, SPAWN)
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK(BM_QuickSortBench)
+    ->Name("QuickSort_" + GetParallelMode())
+    ->Setup(DoSetup)
+    ->UseRealTime()
+    ->ArgName("fork")
+    ->DenseRange(SERIAL_FORK, SPAWN)
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,102 @@
+#include <benchmark/benchmark.h>
+
+#include "../include/parallel_for.h"
+
+static void DoSetup(const benchmark::State &state) {
+  InitParallel(GetNumThreads());
+}
+
+static constexpr size_t TREE_NODES = 1 << 16;
+
+static size_t Leaf(size_t node) {
+  for (size_t j = 0; j != 256; ++j) {
+    CpuRelax();
+  }
+  return node & 1;
+}
+
+// Depth of a tree with the given arity and at least TREE_NODES leaves.
+static size_t TreeDepth(size_t arity) {
+  size_t depth = 0;
+  for (size_t leaves = 1; leaves < TREE_NODES; leaves *= arity) {
+    ++depth;
+  }
+  return depth;
+}
+
+// Every node spawns all its children into one TaskGroup.
+static size_t VisitGroup(size_t node, size_t depth, size_t arity) {
+  if (depth == 0) {
+    return Leaf(node);
+  }
+  std::vector<size_t> results(arity);
+  EigenPartitioner::TaskGroup group;
+  for (size_t i = 0; i != arity; ++i) {
+    group.run([&, i]() {
+      results[i] = VisitGroup(node * arity + i, depth - 1, arity);
+    });
+  }
+  group.wait();
+  size_t sum = 0;
+  for (auto result : results) {
+    sum += result;
+  }
+  return sum;
+}
+
+// Every node halves its children with nested ParallelDo calls.
+static size_t VisitChildrenDo(size_t node, size_t from, size_t to,
+                              size_t depth, size_t arity);
+
+static size_t VisitDo(size_t node, size_t depth, size_t arity) {
+  if (depth == 0) {
+    return Leaf(node);
+  }
+  return VisitChildrenDo(node, 0, arity, depth, arity);
+}
+
+static size_t VisitChildrenDo(size_t node, size_t from, size_t to,
+                              size_t depth, size_t arity) {
+  if (to - from == 1) {
+    return VisitDo(node * arity + from, depth - 1, arity);
+  }
+  auto mid = from + (to - from) / 2;
+  size_t left = 0;
+  size_t right = 0;
+  EigenPartitioner::ParallelDo(
+      [&]() { right = VisitChildrenDo(node, mid, to, depth, arity); },
+      [&]() { left = VisitChildrenDo(node, from, mid, depth, arity); });
+  return left + right;
+}
+
+// Visits a tree of the given arity, "group" = 1 spawns children with a
+// TaskGroup, 0 with nested ParallelDo.
+static void BM_TaskGroupBench(benchmark::State &state) {
+  const size_t arity = state.range(0);
+  const bool group = state.range(1) != 0;
+  const auto depth = TreeDepth(arity);
+  size_t leaves = 1;
+  for (size_t i = 0; i != depth; ++i) {
+    leaves *= arity;
+  }
+  // leaves are numbered 0..leaves-1, half of them are odd (arity is even)
+  const size_t expected = leaves / 2;
+  for (auto _ : state) {
+    auto odd = group ? VisitGroup(0, depth, arity) : VisitDo(0, depth, arity);
+    if (odd != expected) {
+      state.SkipWithError("wrong answer");
+      break;
+    }
+    benchmark::DoNotOptimize(odd);
+  }
+}
+
+BENCHMARK(BM_TaskGroupBench)
+    ->Name("TaskGroup_" + GetParallelMode())
+    ->Setup(DoSetup)
+    ->UseRealTime()
+    ->ArgNames({"arity", "group"})
+    ->ArgsProduct({{2, 4, 16, 64}, {0, 1}})
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
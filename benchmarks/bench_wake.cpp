@@ -0,0 +1,53 @@
+#include <benchmark/benchmark.h>
+
+#include "../include/parallel_for.h"
+
+#include <chrono>
+#include <thread>
+
+static void DoSetup(const benchmark::State &state) {
+  InitParallel(GetNumThreads());
+}
+
+// Each iteration leaves the pool idle for "idle_us" and then runs a tiny
+// parallel loop. Real time shows how fast idle workers pick up new work,
+// process CPU time shows how much CPU they burned while waiting for it.
+static void BM_WakeBench(benchmark::State &state) {
+#ifdef EIGEN_MODE
+  auto prevSpinCount = EigenPool().SpinCount();
+  EigenPool().SetSpinCount(state.range(1));
+#endif
+  auto idle = std::chrono::microseconds(state.range(0));
+  double wakeNs = 0;
+  for (auto _ : state) {
+    std::this_thread::sleep_for(idle);
+    auto start = std::chrono::steady_clock::now();
+    ParallelFor(0, GetNumThreads(), [](size_t) { CpuRelax(); });
+    wakeNs += std::chrono::duration<double, std::nano>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  }
+  state.counters["wake_ns"] =
+      benchmark::Counter(wakeNs, benchmark::Counter::kAvgIterations);
+#ifdef EIGEN_MODE
+  EigenPool().SetSpinCount(prevSpinCount);
+#endif
+}
+
+BENCHMARK(BM_WakeBench)
+    ->Name("Wake_" + GetParallelMode())
+    ->Setup(DoSetup)
+    ->UseRealTime()
+    ->MeasureProcessCPUTime()
+#ifdef EIGEN_MODE
+    ->ArgNames({"idle_us", "spin_count"})
+    ->ArgsProduct({{100, 1000, 10000}, {0, 1 << 10, 1 << 14, 1 << 20}})
+#else
+    ->ArgName("idle_us")
+    ->Arg(100)
+    ->Arg(1000)
+    ->Arg(10000)
+#endif
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -13,3 +13,19 @@ TEST(ParallelFor, PrefixSum) {
     EXPECT_EQ(data[i], sum);
   }
 }
+
+TEST(ParallelFor, ParallelPrefixSum) {
+  for (size_t size : {0, 1, 7, 4096, 4097, 100003}) {
+    std::vector<uint64_t> in(size);
+    for (size_t i = 0; i != size; ++i) {
+      in[i] = i + 1;
+    }
+    std::vector<uint64_t> out(size);
+    Scan::ParallelScan(in.data(), out.data(), size);
+    Scan::ParallelScan(in);
+    for (size_t i = 0; i != size; ++i) {
+      EXPECT_EQ((i + 1) * (i + 2) / 2, out[i]) << size << " " << i;
+      EXPECT_EQ(out[i], in[i]) << size << " " << i;
+    }
+  }
+}
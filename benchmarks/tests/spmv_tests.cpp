@@ -18,3 +18,21 @@ TEST(ParallelFor, SpmvTest) {
     EXPECT_EQ(y[i], y_ref[i]);
   }
 }
+
+TEST(ParallelFor, DenseMatrixTiles) {
+  // tiled and nested loops compute the same
+  auto left = GenDenseMatrix<int64_t>(100, 37);
+  auto right = GenDenseMatrix<int64_t>(37, 70);
+  DenseMatrix<int64_t> product(100, 70);
+  DenseMatrix<int64_t> productNested(100, 70);
+  MultiplyMatrix(left, right, product);
+  MultiplyMatrixNested(left, right, productNested);
+  EXPECT_EQ(productNested.Data, product.Data);
+
+  DenseMatrix<int64_t> transposed(37, 100);
+  DenseMatrix<int64_t> transposedNested(37, 100);
+  TransposeMatrix(left, transposed);
+  TransposeMatrixNested(left, transposedNested);
+  EXPECT_EQ(transposedNested.Data, transposed.Data);
+  EXPECT_EQ(left.Data[99][36], transposed.Data[36][99]);
+}
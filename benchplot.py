@@ -43,6 +43,8 @@ EIGEN_MODES = [
     "EIGEN_SHARING",
     "EIGEN_SHARING_STEALING",
     "EIGEN_SHARING_GRAINSIZE",
+    "EIGEN_SHARING_LAZY",
+    "EIGEN_HEARTBEAT",
 ]
 
 COLORS = "ybgrcmk"
@@ -1,7 +1,9 @@
 #pragma once
 
 #include "../parallel_for.h"
+#include <algorithm>
 #include <cassert>
+#include <utility>
 #include <vector>
 
 namespace Scan {
@@ -44,4 +46,61 @@ template <typename T> void __attribute__((noinline)) Scan(size_t size_pow, std::
     });
   }
 }
+
+// ParallelScan gives every thread a few blocks of at least this size.
+inline constexpr size_t MinScanBlock = 1 << 12;
+inline constexpr size_t ScanBlocksPerThread = 4;
+
+template <typename T> T BlockSum(const T *data, size_t size) {
+  T sum{};
+#pragma omp simd reduction(+ : sum)
+  for (size_t i = 0; i < size; ++i) {
+    sum += data[i];
+  }
+  return sum;
+}
+
+// Inclusive scan of the block starting with offset, in may be equal to out.
+template <typename T>
+void BlockScan(const T *in, T *out, size_t size, T offset) {
+#pragma omp simd reduction(inscan, + : offset)
+  for (size_t i = 0; i < size; ++i) {
+    offset += in[i];
+#pragma omp scan inclusive(offset)
+    out[i] = offset;
+  }
+}
+
+// Inclusive prefix sum of any size: blocks are reduced in one parallel
+// region, the block sums are scanned serially, and blocks are rescanned from
+// their offsets in the second parallel region. in may be equal to out.
+template <typename T>
+void __attribute__((noinline)) ParallelScan(const T *in, T *out, size_t size) {
+  if (size == 0) {
+    return;
+  }
+  size_t maxBlocks = std::max<size_t>(GetNumThreads() * ScanBlocksPerThread, 1);
+  auto blocks =
+      std::min((size + MinScanBlock - 1) / MinScanBlock, maxBlocks);
+  auto blockSize = (size + blocks - 1) / blocks;
+  blocks = (size + blockSize - 1) / blockSize;
+  std::vector<T> offsets(blocks);
+  ParallelFor(0, blocks, [&](size_t block) {
+    auto from = block * blockSize;
+    offsets[block] = BlockSum(in + from, std::min(blockSize, size - from));
+  });
+  T offset{};
+  for (auto &blockOffset : offsets) {
+    offset += std::exchange(blockOffset, offset);
+  }
+  ParallelFor(0, blocks, [&](size_t block) {
+    auto from = block * blockSize;
+    BlockScan(in + from, out + from, std::min(blockSize, size - from),
+              offsets[block]);
+  });
+}
+
+template <typename T> void ParallelScan(std::vector<T> &data) {
+  ParallelScan(data.data(), data.data(), data.size());
+}
 } // namespace Scan
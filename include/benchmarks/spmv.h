@@ -52,8 +52,13 @@ void __attribute__((noinline))
 MultiplyMatrix(const SPMV::SparseMatrixCSR<T> &A, const std::vector<T> &x,
                std::vector<T> &out, size_t grainSize = 1) {
   assert(A.Dimensions.Columns == x.size());
-  ParallelFor(
-      0, A.Dimensions.Rows, [&](size_t i) { out[i] = MultiplyRow(A, x, i); },
+  ParallelForRange(
+      0, A.Dimensions.Rows,
+      [&](size_t from, size_t to) {
+        for (size_t i = from; i != to; ++i) {
+          out[i] = MultiplyRow(A, x, i);
+        }
+      },
       grainSize);
 }
 
@@ -74,7 +79,27 @@ MultiplyMatrix(const SPMV::DenseMatrix<T> &A, const std::vector<T> &x,
 template <typename T>
 void MultiplyMatrix(const SPMV::DenseMatrix<T> &A,
                     const SPMV::DenseMatrix<T> &B, SPMV::DenseMatrix<T> &out,
-                    size_t grainSize = 1) {
+                    size_t tile = 16) {
+  ParallelFor2D(out.Dimensions.Rows, out.Dimensions.Columns, tile,
+                [&](IndexRange rows, IndexRange columns) {
+                  for (size_t row = rows.From; row != rows.To; ++row) {
+                    for (size_t col = columns.From; col != columns.To; ++col) {
+                      T sum{};
+                      for (size_t j = 0; j != A.Dimensions.Columns; ++j) {
+                        sum += A.Data[row][j] * B.Data[j][col];
+                      }
+                      out.Data[row][col] = sum;
+                    }
+                  }
+                });
+}
+
+// Same as MultiplyMatrix, but with a ParallelFor over columns nested into a
+// ParallelFor over rows.
+template <typename T>
+void MultiplyMatrixNested(const SPMV::DenseMatrix<T> &A,
+                          const SPMV::DenseMatrix<T> &B,
+                          SPMV::DenseMatrix<T> &out, size_t grainSize = 1) {
   ParallelFor(
       0, out.Dimensions.Rows,
       [&](size_t row) {
@@ -95,7 +120,25 @@ void MultiplyMatrix(const SPMV::DenseMatrix<T> &A,
 template <typename T>
 void __attribute__((noinline))
 TransposeMatrix(SPMV::DenseMatrix<T> &input, SPMV::DenseMatrix<T> &out,
-                size_t blocks = 64, size_t grainSize = 1) {
+                size_t tile = 32) {
+  assert(input.Dimensions.Rows == out.Dimensions.Columns);
+  assert(input.Dimensions.Columns == out.Dimensions.Rows);
+  ParallelFor2D(input.Dimensions.Rows, input.Dimensions.Columns, tile,
+                [&](IndexRange rows, IndexRange columns) {
+                  for (size_t i = rows.From; i != rows.To; ++i) {
+                    for (size_t j = columns.From; j != columns.To; ++j) {
+                      out.Data[j][i] = input.Data[i][j];
+                    }
+                  }
+                });
+}
+
+// Same as TransposeMatrix, but with blocks of columns in a ParallelForRange
+// nested into one over blocks of rows.
+template <typename T>
+void __attribute__((noinline))
+TransposeMatrixNested(SPMV::DenseMatrix<T> &input, SPMV::DenseMatrix<T> &out,
+                      size_t blocks = 64, size_t grainSize = 1) {
   assert(input.Dimensions.Rows == out.Dimensions.Columns);
   assert(input.Dimensions.Columns == out.Dimensions.Rows);
   auto blocksRows = std::min(blocks, input.Dimensions.Rows);
@@ -103,19 +146,25 @@ TransposeMatrix(SPMV::DenseMatrix<T> &input, SPMV::DenseMatrix<T> &out,
   auto blockRowSize = (input.Dimensions.Rows + blocksRows - 1) / blocksRows;
   auto blockColumnSize =
       (input.Dimensions.Columns + blocksColumns - 1) / blocksColumns;
-  ParallelFor(
+  ParallelForRange(
       0, blocksRows,
-      [&](size_t row) {
-        ParallelFor(0, blocksColumns, [&](size_t column) {
-          auto fromRow = row * blockRowSize;
-          auto fromCol = column * blockColumnSize;
-          for (size_t i = fromRow;
-               i != std::min(input.Dimensions.Rows, fromRow + blockRowSize);
-               ++i) {
-            for (size_t j = fromCol; j != std::min(input.Dimensions.Columns,
-                                                   fromCol + blockColumnSize);
-                 ++j) {
-              out.Data[j][i] = input.Data[i][j];
+      [&](size_t rowFrom, size_t rowTo) {
+        ParallelForRange(0, blocksColumns, [&](size_t columnFrom,
+                                               size_t columnTo) {
+          for (size_t row = rowFrom; row != rowTo; ++row) {
+            for (size_t column = columnFrom; column != columnTo; ++column) {
+              auto fromRow = row * blockRowSize;
+              auto fromCol = column * blockColumnSize;
+              for (size_t i = fromRow;
+                   i < std::min(input.Dimensions.Rows, fromRow + blockRowSize);
+                   ++i) {
+                for (size_t j = fromCol;
+                     j < std::min(input.Dimensions.Columns,
+                                  fromCol + blockColumnSize);
+                     ++j) {
+                  out.Data[j][i] = input.Data[i][j];
+                }
+              }
             }
           }
         });
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace Eigen {
+
+// ChaseLevDeque is a fixed-size, lock-free work-stealing deque that can be
+// used instead of RunQueue for thread local queues of the pool.
+// Operations on front of the queue must be done by a single thread (owner),
+// operations on back of the queue can be done by multiple threads concurrently.
+// Unlike RunQueue, remote threads can only take elements (there is no
+// PushBack), but they never take a lock: every PopBack is a single CAS on
+// the back index, so thieves don't serialize on the victim.
+//
+// Algorithm follows "Correct and Efficient Work-Stealing for Weak Memory
+// Models" (Le, Pop, Cohen, Zappa Nardelli, PPoPP'13) with a bounded buffer:
+// PushFront fails when the queue is full, exactly like RunQueue does.
+// Work must be trivially copyable (e.g. a pointer or a TaskCell), empty Work()
+// means "no element". Slots are accessed word by word with relaxed atomics, so
+// Work can be larger than a lock-free std::atomic: a thief can read a slot
+// that is being overwritten, but then its CAS on back_ fails and the torn copy
+// is thrown away.
+template <typename Work, unsigned kSize> class ChaseLevDeque {
+  static_assert((kSize & (kSize - 1)) == 0, "kSize must be a power of two");
+  static_assert(std::is_trivially_copyable_v<Work>,
+                "Work must be trivially copyable");
+
+public:
+  ChaseLevDeque() : front_(0), back_(0) {
+    for (unsigned i = 0; i < kSize; i++)
+      array_[i].Store(Work());
+  }
+
+  ~ChaseLevDeque() { assert(Size() == 0); }
+
+  // PushFront inserts w at the beginning of the queue.
+  // Returns false if the queue is full.
+  bool PushFront(Work w) {
+    int64_t front = front_.load(std::memory_order_relaxed);
+    int64_t back = back_.load(std::memory_order_acquire);
+    if (front - back >= static_cast<int64_t>(kSize))
+      return false;
+    array_[front & kMask].Store(w);
+    std::atomic_thread_fence(std::memory_order_release);
+    front_.store(front + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // PopFront removes and returns the first element in the queue.
+  // If the queue was empty returns default-constructed Work.
+  Work PopFront() {
+    int64_t front = front_.load(std::memory_order_relaxed) - 1;
+    front_.store(front, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t back = back_.load(std::memory_order_relaxed);
+    if (back > front) {
+      // queue was empty
+      front_.store(front + 1, std::memory_order_relaxed);
+      return Work();
+    }
+    Work w = array_[front & kMask].Load();
+    if (back == front) {
+      // last element, race with thieves for it
+      if (!back_.compare_exchange_strong(back, back + 1,
+                                         std::memory_order_seq_cst,
+                                         std::memory_order_relaxed)) {
+        w = Work();
+      }
+      front_.store(front + 1, std::memory_order_relaxed);
+    }
+    return w;
+  }
+
+  // PopBack removes and returns the last element in the queue.
+  // Returns default-constructed Work if the queue was empty or another thread
+  // took the element first.
+  Work PopBack() {
+    int64_t back = back_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t front = front_.load(std::memory_order_acquire);
+    if (back >= front)
+      return Work();
+    Work w = array_[back & kMask].Load();
+    if (!back_.compare_exchange_strong(back, back + 1,
+                                       std::memory_order_seq_cst,
+                                       std::memory_order_relaxed))
+      return Work();
+    return w;
+  }
+
+  // PopBackHalf removes and returns half last elements in the queue.
+  // Returns number of elements removed.
+  // The owner can pop from the same end concurrently, so elements are claimed
+  // one by one, each with its own CAS. Like in RunQueue, elements are appended
+  // from the newest to the oldest one.
+  unsigned PopBackHalf(std::vector<Work> *result) {
+    unsigned size = Size();
+    unsigned n = 0;
+    for (unsigned i = 0; i < (size + 1) / 2; i++) {
+      Work w = PopBack();
+      if (!w)
+        break;
+      result->push_back(std::move(w));
+      n++;
+    }
+    std::reverse(result->end() - n, result->end());
+    return n;
+  }
+
+  // Size returns current queue size.
+  // Can be called by any thread at any time.
+  unsigned Size() const {
+    int64_t back = back_.load(std::memory_order_acquire);
+    int64_t front = front_.load(std::memory_order_acquire);
+    int64_t size = front - back;
+    if (size < 0)
+      return 0;
+    return static_cast<unsigned>(size > kSize ? kSize : size);
+  }
+
+  // Empty tests whether container is empty.
+  // Can be called by any thread at any time.
+  bool Empty() const { return Size() == 0; }
+
+  // Delete all the elements from the queue.
+  void Flush() {
+    while (!Empty()) {
+      PopFront();
+    }
+  }
+
+private:
+  static const unsigned kMask = kSize - 1;
+  static constexpr size_t kWords =
+      (sizeof(Work) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+  struct Slot {
+    std::atomic<uint64_t> words[kWords];
+
+    void Store(const Work &w) {
+      uint64_t raw[kWords] = {};
+      std::memcpy(raw, &w, sizeof(Work));
+      for (size_t i = 0; i < kWords; i++)
+        words[i].store(raw[i], std::memory_order_relaxed);
+    }
+
+    Work Load() const {
+      uint64_t raw[kWords];
+      for (size_t i = 0; i < kWords; i++)
+        raw[i] = words[i].load(std::memory_order_relaxed);
+      Work w;
+      std::memcpy(&w, raw, sizeof(Work));
+      return w;
+    }
+  };
+
+  // keep owner and thieves indices on different cache lines
+  static constexpr size_t kAlignment = 128;
+
+  // front_ is only written by the owner, back_ only grows via CAS.
+  alignas(kAlignment) std::atomic<int64_t> front_;
+  alignas(kAlignment) std::atomic<int64_t> back_;
+  alignas(kAlignment) Slot array_[kSize];
+
+  ChaseLevDeque(const ChaseLevDeque &) = delete;
+  void operator=(const ChaseLevDeque &) = delete;
+};
+
+} // namespace Eigen
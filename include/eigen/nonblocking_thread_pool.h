@@ -14,22 +14,30 @@
 #define EIGEN_CXX11_THREADPOOL_NONBLOCKING_THREAD_POOL_H
 #define EIGEN_POOL_RUNNEXT
 
+#include "chase_lev_deque.h"
 #include "max_size_vector.h"
 #include "run_queue.h"
 #include "stl_thread_env.h"
+#include "task_allocator.h"
+#include "task_cell.h"
 #include "../util.h"
 
 #include <atomic>
 #include <cassert>
+#include <deque>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <thread>
+#include <vector>
 
 namespace Eigen {
 
-struct Task {
+// Tasks are created and destroyed on every split, usually on different
+// threads, so they are allocated with TaskAllocator.
+struct Task : TaskAllocated {
   virtual void operator()() = 0;
   virtual ~Task() = default;
 };
@@ -50,39 +58,13 @@ template <typename F> Task *MakeTask(F &&f) {
   return new UniqueTask<decltype(std::forward<F>(f))>{std::forward<F>(f)};
 }
 
-/**/
-template <typename F>
-struct ProxyTask : Task {
-  ProxyTask(F&& func)
-    : Func_{std::move(func)}
-  {}
-
-  void operator()() override {
-    // We should enter this function 2 times
-    // prevState:
-    // 0 => first entrance, run Func_
-    // 1 in same thread  => this thread finished Func_ before other thread entered
-    // 1 in other thread => other thread entered function before Func_ is finished
-    // 2 this is the last change of state, drop object
-    auto prevState = State_.fetch_add(1, std::memory_order_seq_cst);
-    if (prevState == 0) {
-      Func_();
-      prevState = State_.fetch_add(1, std::memory_order_seq_cst);
-    }
-    if (prevState == 2) {
-      delete this;
-    }
-  }
-
-  std::decay_t<F> Func_;
-  std::atomic_uint_fast32_t State_ = 0;
+// Child of a fork that lives on the stack of the thread that spawned it (see
+// EigenPartitioner::Spawn), so pushing it allocates nothing. Frames are
+// stolen like tasks, the spawner pops its frame back if nobody took it.
+struct SpawnedFrame {
+  void (*run)(SpawnedFrame *);
 };
 
-template <typename F> Task *MakeProxyTask(F &&f) {
-  return new ProxyTask{std::forward<F>(f)};
-}
-/**/
-
 // This defines an interface that ThreadPoolDevice can take to use
 // custom thread pools underneath.
 class ThreadPoolInterface {
@@ -113,11 +95,22 @@ public:
   virtual ~ThreadPoolInterface() {}
 };
 
+// Priority class of a task. High priority tasks are kept in separate queues
+// that workers check before anything else, so latency-critical loops don't
+// wait behind background work queued on the same workers.
+enum class Priority { HIGH, NORMAL };
+
 template <typename Environment>
 class ThreadPoolTempl : public Eigen::ThreadPoolInterface {
 public:
   using TaskPtr = Task *;
-  using Queue = RunQueue<TaskPtr, 1024>;
+  // Queues store closures by value, see TaskCell.
+  using Work = TaskCell;
+#ifdef EIGEN_POOL_CHASE_LEV
+  using Queue = ChaseLevDeque<Work, 1024>;
+#else
+  using Queue = RunQueue<Work, 1024>;
+#endif
 
   ThreadPoolTempl(int num_threads, Environment env = Environment())
       : ThreadPoolTempl(num_threads, true, false, env) {}
@@ -125,9 +118,13 @@ public:
   ThreadPoolTempl(int num_threads, bool allow_spinning, bool use_main_thread,
                   Environment env = Environment())
       : env_(env), num_threads_(num_threads), allow_spinning_(allow_spinning),
+        use_main_thread_(use_main_thread),
         thread_data_(num_threads), all_coprimes_(num_threads),
         global_steal_partition_(EncodePartition(0, num_threads_)), blocked_(0),
-        spinning_(0), done_(false), cancelled_(false) {
+        urgent_size_(0),
+        spin_count_(allow_spinning ? kDefaultSpinCount : 0),
+        steal_half_(false), done_(false),
+        cancelled_(false) {
     // Calculate coprimes of all numbers [1, num_threads].
     // Coprimes are used for random walks over all threads in Steal
     // and NonEmptyQueueIndex. Iteration is based on the fact that if we take
@@ -143,7 +140,9 @@ public:
     thread_data_.resize(num_threads_);
     for (int i = 0; i < num_threads_; i++) {
       SetStealPartition(i, EncodePartition(0, num_threads_));
-      if (i == 0) {
+      if (i == 0 && use_main_thread_) {
+        // the constructing thread is worker 0, it joins the pool only when
+        // it waits for its tasks (see JoinMainThread)
         PerThread *pt = GetPerThread();
         pt->pool = this;
         pt->rand = GlobalThreadIdHash();
@@ -162,6 +161,7 @@ public:
 
   ~ThreadPoolTempl() {
     done_ = true;
+    UnparkAll();
 
     // Now if all threads block without work, they will start exiting.
     // But note that threads can continue to work arbitrary long,
@@ -193,29 +193,55 @@ public:
     }
   }
 
-  void Schedule(TaskPtr p) override {
+  // Sets nested steal domains of each thread, nearest first (e.g. threads
+  // sharing L2, then LLC, then NUMA node). LocalSteal tries them in this
+  // order before GlobalSteal goes to the whole pool. Levels after
+  // kStealLevels are ignored.
+  void SetStealDomains(
+      const std::vector<std::vector<std::pair<unsigned, unsigned>>> &domains) {
+    assert(domains.size() == static_cast<std::size_t>(num_threads_));
+
+    for (int i = 0; i < num_threads_; i++) {
+      for (int level = 0; level < kStealLevels; level++) {
+        unsigned val = global_steal_partition_;
+        if (level < static_cast<int>(domains[i].size())) {
+          unsigned start = domains[i][level].first;
+          unsigned end = domains[i][level].second;
+          AssertBounds(start, end);
+          val = EncodePartition(start, end);
+        }
+        SetStealPartition(i, level, val);
+      }
+    }
+  }
+
+  void Schedule(Work w, Priority priority = Priority::NORMAL) {
     // schedule on main thread only when explicitly requested
-    ScheduleWithHint(p, 0, num_threads_);
+    ScheduleWithHint(std::move(w), 0, num_threads_, priority);
   }
 
-  void RunOnThread(TaskPtr t, size_t threadIndex) {
+  void Schedule(TaskPtr p) override { Schedule(Work{[p]() { (*p)(); }}); }
+
+  void RunOnThread(Work t, size_t threadIndex,
+                   Priority priority = Priority::NORMAL) {
     threadIndex = threadIndex % num_threads_;
     PerThread *pt = GetPerThread();
-    if (!thread_data_[threadIndex].PushTask(
-            t, (pt && threadIndex == pt->thread_id))) {
-      // failed to push, execute directly
-      ExecuteTask(t);
-    }
+    const bool localThread = pt->pool == this && threadIndex == pt->thread_id;
+    Push(threadIndex, t, localThread, priority);
+    Notify(localThread ? -1 : static_cast<int>(threadIndex));
+  }
+
+  void ScheduleWithHint(TaskPtr p, int start, int limit) override {
+    ScheduleWithHint(Work{[p]() { (*p)(); }}, start, limit);
   }
 
-  void ScheduleWithHint(TaskPtr t, int start, int limit) override {
+  void ScheduleWithHint(Work t, int start, int limit,
+                        Priority priority = Priority::NORMAL) {
     PerThread *pt = GetPerThread();
-    bool pushed = false;
     if (pt->pool == this) {
       // Worker thread of this pool, push onto the thread's queue.
-      if (thread_data_[pt->thread_id].PushTask(t, true)) {
-        return;
-      }
+      Push(pt->thread_id, t, true, priority);
+      Notify(-1);
     } else {
       // A free-standing thread (or worker of another pool), push onto a random
       // queue.
@@ -224,24 +250,16 @@ public:
       int num_queues = limit - start;
       int rnd = Rand(&pt->rand) % num_queues;
       assert(start + rnd < limit);
-      const bool localThread = (start + rnd) == pt->thread_id;
-      if (thread_data_[start + rnd].PushTask(t, localThread)) {
-        return;
-      }
+      // the queue is never local: thread_id belongs to another pool
+      Push(start + rnd, t, /* localThread */ false, priority);
+      Notify(start + rnd);
     }
-    // Note: below we touch this after making w available to worker threads.
-    // Strictly speaking, this can lead to a racy-use-after-free. Consider that
-    // Schedule is called from a thread that is neither main thread nor a worker
-    // thread of this pool. Then, execution of w directly or indirectly
-    // completes overall computations, which in turn leads to destruction of
-    // this. We expect that such scenario is prevented by program, that is,
-    // this is kept alive while any threads can potentially be in Schedule.
-    ExecuteTask(t); // Push failed, execute directly.
   }
 
   void Cancel() override {
     cancelled_ = true;
     done_ = true;
+    UnparkAll();
 
     // Let each thread know it's been cancelled.
 #ifdef EIGEN_THREAD_ENV_SUPPORTS_CANCELLATION
@@ -253,6 +271,28 @@ public:
 
   size_t NumThreads() const final { return num_threads_; }
 
+  // false if all threads of the pool are dedicated workers
+  bool UsesMainThread() const { return use_main_thread_; }
+
+  // Sets the number of consecutive unsuccessful attempts to find a task
+  // after which an idle worker parks until new work is submitted.
+  // Zero parks idle workers right away, UINT_MAX never parks them.
+  void SetSpinCount(unsigned spin_count) {
+    spin_count_.store(spin_count, std::memory_order_relaxed);
+  }
+
+  unsigned SpinCount() const {
+    return spin_count_.load(std::memory_order_relaxed);
+  }
+
+  // Enables batch stealing: a thief that gets to the local queue of a victim
+  // moves half of it into its own queue at once instead of taking one task.
+  void SetStealHalf(bool steal_half) {
+    steal_half_.store(steal_half, std::memory_order_relaxed);
+  }
+
+  bool StealHalf() const { return steal_half_.load(std::memory_order_relaxed); }
+
   size_t CurrentThreadId() const final {
     const PerThread *pt = const_cast<ThreadPoolTempl *>(this)->GetPerThread();
     if (pt->pool == this) {
@@ -270,6 +310,47 @@ public:
     return WorkerLoop(/* external */ true);
   }
 
+  // Runs one task of the pool on a thread that doesn't belong to it, e.g. a
+  // worker of another pool that waits for a loop submitted here and would
+  // otherwise keep its own pool from progressing. Returns false if there was
+  // nothing to steal.
+  bool TryExecuteAsGuest() {
+    if (CurrentThreadId() != -1) [[unlikely]] {
+      return false;
+    }
+    Work t = GlobalSteal(/* force */ true);
+    if (!t) {
+      return false;
+    }
+    Tracing::TaskStolen();
+    t();
+    return true;
+  }
+
+  // Pushes a frame spawned by the calling worker, thieves take frames from
+  // the oldest one. Returns false if the frame deque is full.
+  bool PushFrame(SpawnedFrame *frame) {
+    assert(CurrentThreadId() != -1);
+    auto &data = thread_data_[GetPerThread()->thread_id];
+    if (!data.frames.PushFront(frame)) [[unlikely]] {
+      return false;
+    }
+    // The spawner runs its frame itself if nobody takes it, so a worker that
+    // parks concurrently costs parallelism, not progress, and is woken up by
+    // one of the next pushes. That keeps the full fence of Notify off the
+    // fast path.
+    if (blocked_.load(std::memory_order_relaxed) != 0) [[unlikely]] {
+      Notify(-1);
+    }
+    return true;
+  }
+
+  // Pops the newest frame of the calling worker, nullptr if it was stolen.
+  SpawnedFrame *PopFrame() {
+    assert(CurrentThreadId() != -1);
+    return thread_data_[GetPerThread()->thread_id].frames.PopFront();
+  }
+
   bool TryExecuteSomething() {
     if (CurrentThreadId() == -1) [[unlikely]] {
       return false;
@@ -289,12 +370,17 @@ private:
   // scheduling and steal domain(s).
   static const int kMaxPartitionBits = 16;
   static const int kMaxThreads = 1 << kMaxPartitionBits;
+  static const int kStealLevels = 4;
+
+  // Roughly tens of milliseconds of stealing attempts on a big machine, so
+  // back-to-back parallel loops never see a parked worker.
+  static const unsigned kDefaultSpinCount = 1 << 14;
 
   inline unsigned EncodePartition(unsigned start, unsigned limit) {
     return (start << kMaxPartitionBits) | limit;
   }
 
-  void ExecuteTask(TaskPtr p) { (*p)(); }
+  void ExecuteTask(Work &w) { w(); }
 
   inline void DecodePartition(unsigned val, unsigned *start, unsigned *limit) {
     *limit = val & (kMaxThreads - 1);
@@ -309,11 +395,20 @@ private:
   }
 
   inline void SetStealPartition(size_t i, unsigned val) {
-    thread_data_[i].steal_partition.store(val, std::memory_order_relaxed);
+    SetStealPartition(i, 0, val);
+    for (int level = 1; level < kStealLevels; level++) {
+      SetStealPartition(i, level, EncodePartition(0, num_threads_));
+    }
+  }
+
+  inline void SetStealPartition(size_t i, int level, unsigned val) {
+    thread_data_[i].steal_partition[level].store(val,
+                                                 std::memory_order_relaxed);
   }
 
-  inline unsigned GetStealPartition(int i) {
-    return thread_data_[i].steal_partition.load(std::memory_order_relaxed);
+  inline unsigned GetStealPartition(int i, int level) {
+    return thread_data_[i].steal_partition[level].load(
+        std::memory_order_relaxed);
   }
 
   void ComputeCoprimes(int N, MaxSizeVector<unsigned> *coprimes) {
@@ -341,13 +436,76 @@ private:
     int thread_id;         // Worker thread index in pool.
   };
 
+  // Tasks that didn't fit into a bounded queue. Rarely used, so a plain
+  // mutex is enough; size lets readers skip the lock.
+  struct OverflowList {
+    std::mutex mutex;
+    std::deque<Work> tasks;
+    std::atomic<size_t> size{0};
+
+    bool Empty() const { return size.load(std::memory_order_relaxed) == 0; }
+
+    void Push(Work p) {
+      Tracing::TaskOverflowed();
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push_back(p);
+      size.store(tasks.size(), std::memory_order_release);
+    }
+
+    Work Pop(bool newest) {
+      if (size.load(std::memory_order_acquire) == 0) {
+        return Work();
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      if (tasks.empty()) {
+        return Work();
+      }
+      Work task;
+      if (newest) {
+        task = tasks.back();
+        tasks.pop_back();
+      } else {
+        task = tasks.front();
+        tasks.pop_front();
+      }
+      size.store(tasks.size(), std::memory_order_release);
+      return task;
+    }
+
+    // Destroys all tasks without running them.
+    void Flush() {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto &task : tasks) {
+        task.Reset();
+      }
+      tasks.clear();
+      size.store(0, std::memory_order_relaxed);
+    }
+  };
+
   struct ThreadData {
-    constexpr ThreadData() : thread(), steal_partition(0), local_tasks(), mailbox(1024) {}
+    constexpr ThreadData() : thread(), steal_partition(), local_tasks(), mailbox(1024), urgent(1024) {}
     std::unique_ptr<Thread> thread;
-    std::atomic<unsigned> steal_partition;
+    std::atomic<unsigned> steal_partition[kStealLevels]; // nearest first
     Queue local_tasks;
-    rigtorp::mpmc::Queue<TaskPtr> mailbox;
+    rigtorp::mpmc::Queue<Work> mailbox;
+    // High priority tasks in FIFO order, popped by the owner and by thieves
+    // before any other queue (see PopUrgent).
+    rigtorp::mpmc::Queue<Work> urgent;
     std::size_t stack_size = size_t{16} * 1024 * 1024;
+    // 1 while the owner is parked (or about to park), see Park.
+    std::atomic<uint32_t> parked{0};
+    // Own pushes that didn't fit into local_tasks: they are the newest tasks
+    // of the owner, so it pops them before local_tasks, newest first. While
+    // the list isn't empty further own pushes go there as well, which keeps
+    // the owner's order LIFO across both.
+    OverflowList overflow;
+    // Pushes of other threads that didn't fit into mailbox, FIFO like it.
+    OverflowList mailbox_overflow;
+    // Scratch space of the owner for batch steals from other threads.
+    std::vector<Work> steal_batch;
+    // Frames spawned by the owner, newest first (see PushFrame).
+    ChaseLevDeque<SpawnedFrame *, 256> frames;
 #ifdef EIGEN_POOL_RUNNEXT
     std::atomic<TaskPtr> runnext{nullptr};
     // use IDLE to indicate that the thread is idling and tasks shouldn't be
@@ -355,7 +513,17 @@ private:
     static inline const TaskPtr IDLE = reinterpret_cast<TaskPtr>(1);
 #endif
 
-    bool PushTask(TaskPtr p, bool localThread) {
+    // Never fails: if the bounded queue is full the task goes to its
+    // overflow list, where it is still visible to the owner and to thieves.
+    void PushTask(Work p, bool localThread) {
+      if (localThread && !overflow.Empty()) {
+        overflow.Push(p);
+      } else if (!TryPushTask(p, localThread)) {
+        (localThread ? overflow : mailbox_overflow).Push(p);
+      }
+    }
+
+    bool TryPushTask(Work &p, bool localThread) {
       if (localThread) {
 // #ifdef EIGEN_POOL_RUNNEXT
 //         if (runnext.load(std::memory_order_relaxed) == nullptr) {
@@ -389,38 +557,109 @@ private:
       }
     }
 
-    TaskPtr PopFront() {
+    Work PopFront() {
 #ifdef EIGEN_POOL_RUNNEXT
       if (auto p = PopRunnext(); p && p != IDLE) {
-        return p;
+        return Work{[p]() { (*p)(); }};
       }
 #endif
+      if (Work p = overflow.Pop(/* newest */ true)) {
+        return p;
+      }
       if (auto p = local_tasks.PopFront()) {
         return p;
       }
-      TaskPtr task = nullptr;
-      mailbox.try_pop(task);
-      return task;
+      Work task;
+      if (mailbox.try_pop(task)) {
+        return task;
+      }
+      return mailbox_overflow.Pop(/* newest */ false);
     }
 
-    TaskPtr PopBack(bool force) {
-      TaskPtr task = nullptr;
+    // Returns true if the owner has nothing to pop.
+    bool Empty() const {
+      return local_tasks.Empty() && frames.Empty() && mailbox.empty() &&
+             urgent.empty() && overflow.Empty() && mailbox_overflow.Empty();
+    }
+
+    // Returns true if PopBack(/* force */ true) might find a task.
+    bool CanSteal() const {
+      if (!urgent.empty()) {
+        return true;
+      }
+#if defined(EIGEN_SHARING) or defined(EIGEN_SHARING_STEALING)
+      if (!mailbox.empty()) {
+        return true;
+      }
+#endif
+      return !local_tasks.Empty() || !frames.Empty() || !overflow.Empty() ||
+             !mailbox_overflow.Empty();
+    }
+
+    Work PopFrameBack() {
+      if (SpawnedFrame *frame = frames.PopBack()) {
+        return Work{[frame]() { frame->run(frame); }};
+      }
+      return Work();
+    }
+
+    Work PopBack(bool force) {
+      Work task;
 #if defined(EIGEN_SHARING) or defined(EIGEN_SHARING_STEALING)
       mailbox.try_pop(task);
 #endif
+      if (!task && force) {
+        task = PopFrameBack();
+      }
       if (!task && force) {
         task = local_tasks.PopBack();
       }
+      if (!task && force) {
+        task = PopOverflows();
+      }
       return task;
     }
 
+    // Same as PopBack(/* force */ true), but takes half of local_tasks at
+    // once: returns the oldest of them and appends others to batch, from the
+    // newest to the oldest.
+    Work PopBackHalf(std::vector<Work> *batch) {
+      Work task;
+      if (mailbox.try_pop(task)) {
+        return task;
+      }
+      // the oldest frame is the largest part of the spawner's work
+      if (Work frame = PopFrameBack()) {
+        return frame;
+      }
+      if (local_tasks.PopBackHalf(batch) != 0) {
+        task = batch->back();
+        batch->pop_back();
+        return task;
+      }
+      return PopOverflows();
+    }
+
+    // Oldest spilled task for a thief.
+    Work PopOverflows() {
+      if (Work task = overflow.Pop(/* newest */ false)) {
+        return task;
+      }
+      return mailbox_overflow.Pop(/* newest */ false);
+    }
+
+    // Destroys all queued tasks without running them.
     void Flush() {
-      while (!mailbox.empty()) {
-        TaskPtr task = nullptr;
-        mailbox.pop(task);
+      overflow.Flush();
+      mailbox_overflow.Flush();
+      for (auto queue : {&urgent, &mailbox}) {
+        Work task;
+        while (queue->try_pop(task)) {
+          task.Reset();
+        }
       }
       while (!local_tasks.Empty()) {
-        local_tasks.PopFront();
+        local_tasks.PopFront().Reset();
       }
     }
 
@@ -436,24 +675,20 @@ private:
       return nullptr;
     }
 
-    TaskPtr StealWithRunnext() {
-      TaskPtr t = PopBack();
-      if (!t) {
-        t = PopRunnext();
-      }
-      return t;
-    }
 #endif
   };
 
   Environment env_;
   const int num_threads_;
   const bool allow_spinning_;
+  const bool use_main_thread_;
   MaxSizeVector<ThreadData> thread_data_;
   MaxSizeVector<MaxSizeVector<unsigned>> all_coprimes_;
   unsigned global_steal_partition_;
-  std::atomic<unsigned> blocked_;
-  std::atomic<bool> spinning_;
+  std::atomic<unsigned> blocked_; // number of parked workers
+  std::atomic<unsigned> urgent_size_; // tasks in urgent queues of all workers
+  std::atomic<unsigned> spin_count_;
+  std::atomic<bool> steal_half_;
   std::atomic<bool> done_;
   std::atomic<bool> cancelled_;
 
@@ -468,8 +703,12 @@ private:
     threadData.ResetIdle();
     bool processed_anything = false;
     bool all_empty = false;
+    unsigned spins = 0;
     while (!cancelled_) {
-      TaskPtr t = threadData.PopFront();
+      Work t = PopUrgent(thread_id);
+      if (!t) {
+        t = threadData.PopFront();
+      }
       if (!t && (!external || can_steal)) {
         t = LocalSteal(all_empty);
         if (t) {
@@ -482,6 +721,14 @@ private:
           Tracing::TaskStolen();
         }
       }
+      if (!t && external && !can_steal) {
+        // Shared tasks are pushed only to the mailbox of the target thread,
+        // a waiting thread can still claim them from there.
+        t = GlobalSteal(/* force */ false);
+        if (t) {
+          Tracing::TaskStolen();
+        }
+      }
       if (!t && external && threadData.SetIdle()) {
         // external thread shouldn't wait for work, it should just exit.
         return processed_anything;
@@ -490,10 +737,17 @@ private:
         ExecuteTask(t);
         processed_anything = true;
         all_empty = false;
+        spins = 0;
       } else if (done_) {
         return processed_anything;
       } else {
         all_empty = true;
+        // external threads return above, only pool workers get parked
+        if (!external &&
+            ++spins > spin_count_.load(std::memory_order_relaxed)) {
+          Park(threadData);
+          spins = 0;
+        }
       }
       if (once) {
         break;
@@ -505,7 +759,7 @@ private:
 
   // Steal tries to steal work from other worker threads in the range [start,
   // limit) in best-effort manner.
-  TaskPtr Steal(unsigned start, unsigned limit, bool force) {
+  Work Steal(unsigned start, unsigned limit, bool force) {
     PerThread *pt = GetPerThread();
     const size_t size = limit - start;
     unsigned r = Rand(&pt->rand);
@@ -519,8 +773,17 @@ private:
 
     for (unsigned i = 0; i < size; i++) {
       assert(start + victim < limit);
-      TaskPtr t = thread_data_[start + victim].PopBack(force);
+      Tracing::StealAttempt();
+      // threads of other pools have no local queue to take a batch to
+      Work t = PopUrgentOf(start + victim);
+      if (!t) {
+        t = force && steal_half_.load(std::memory_order_relaxed) &&
+                    pt->pool == this
+                ? StealHalf(start + victim)
+                : thread_data_[start + victim].PopBack(force);
+      }
       if (t) {
+        Tracing::StealSuccess();
         return t;
       }
       victim += inc;
@@ -528,38 +791,104 @@ private:
         victim -= size;
       }
     }
-    return nullptr;
+    return Work();
   }
 
-  // Steals work within threads belonging to the partition.
-  TaskPtr LocalSteal(bool force) {
-    PerThread *pt = GetPerThread();
-    unsigned partition = GetStealPartition(pt->thread_id);
-    // If thread steal partition is the same as global partition, there is no
-    // need to go through the steal loop twice.
-    if (global_steal_partition_ == partition)
-      return nullptr;
-    unsigned start, limit;
-    DecodePartition(partition, &start, &limit);
-    AssertBounds(start, limit);
+  // Pushes a task to the queues of the given thread. High priority tasks go
+  // to its urgent queue unless it is full.
+  void Push(unsigned thread_id, Work &t, bool localThread, Priority priority) {
+    auto &data = thread_data_[thread_id];
+    if (priority == Priority::HIGH) {
+      // count first, so the task is never in a queue without being counted
+      urgent_size_.fetch_add(1, std::memory_order_relaxed);
+      if (data.urgent.try_push(t)) {
+        return;
+      }
+      urgent_size_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    data.PushTask(t, localThread);
+  }
+
+  Work PopUrgentOf(unsigned victim) {
+    Work t;
+    if (thread_data_[victim].urgent.try_pop(t)) {
+      urgent_size_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return t;
+  }
+
+  // Takes a high priority task: from the own urgent queue first, then from
+  // urgent queues of other threads. Costs a single load while there are no
+  // high priority tasks.
+  Work PopUrgent(unsigned thread_id) {
+    if (urgent_size_.load(std::memory_order_relaxed) == 0) {
+      return Work();
+    }
+    for (unsigned i = 0; i != static_cast<unsigned>(num_threads_); ++i) {
+      unsigned victim = thread_id + i;
+      if (victim >= static_cast<unsigned>(num_threads_)) {
+        victim -= num_threads_;
+      }
+      if (Work t = PopUrgentOf(victim)) {
+        return t;
+      }
+    }
+    return Work();
+  }
+
+  // Takes half of the victim's local queue, returns the oldest task and keeps
+  // the rest in the local queue of the calling thread.
+  Work StealHalf(unsigned victim) {
+    auto &data = thread_data_[GetPerThread()->thread_id];
+    auto &batch = data.steal_batch;
+    Work t = thread_data_[victim].PopBackHalf(&batch);
+    if (!batch.empty()) {
+      // push older tasks first, so they are stolen first from us as well
+      for (auto it = batch.rbegin(); it != batch.rend(); ++it) {
+        data.PushTask(*it, /* localThread */ true);
+      }
+      batch.clear();
+      Notify(-1);
+    }
+    return t;
+  }
 
-    return Steal(start, limit, force);
+  // Steals work within threads belonging to the partitions of the thread,
+  // from the nearest to the widest one.
+  Work LocalSteal(bool force) {
+    PerThread *pt = GetPerThread();
+    for (int level = 0; level < kStealLevels; level++) {
+      unsigned partition = GetStealPartition(pt->thread_id, level);
+      // If thread steal partition is the same as global partition, there is
+      // no need to go through the steal loop twice.
+      if (global_steal_partition_ == partition)
+        return Work();
+      unsigned start, limit;
+      DecodePartition(partition, &start, &limit);
+      AssertBounds(start, limit);
+
+      if (Work t = Steal(start, limit, force)) {
+        return t;
+      }
+    }
+    return Work();
   }
 
   // Steals work from any other thread in the pool.
-  TaskPtr GlobalSteal(bool force) { return Steal(0, num_threads_, force); }
+  Work GlobalSteal(bool force) { return Steal(0, num_threads_, force); }
 
   int NonEmptyQueueIndex() {
     PerThread *pt = GetPerThread();
     // We intentionally design NonEmptyQueueIndex to steal work from
-    // anywhere in the queue so threads don't block in WaitForWork() forever
+    // anywhere in the queue so threads don't block in Park() forever
     // when all threads in their partition go to sleep. Steal is still local.
     const size_t size = thread_data_.size();
     unsigned r = Rand(&pt->rand);
     unsigned inc = all_coprimes_[size - 1][r % all_coprimes_[size - 1].size()];
     unsigned victim = r % size;
     for (unsigned i = 0; i < size; i++) {
-      if (!thread_data_[victim].queue.Empty()) {
+      const auto &data = thread_data_[victim];
+      if (victim == pt->thread_id ? !data.Empty() : data.CanSteal()) {
         return victim;
       }
       victim += inc;
@@ -570,6 +899,67 @@ private:
     return -1;
   }
 
+  // Parks the calling worker until Notify or UnparkAll wakes it up.
+  //
+  // The worker first announces itself in blocked_ and only then re-checks the
+  // queues, while producers publish a task and only then check blocked_.
+  // With a full fence on both sides either the producer sees the parked
+  // worker and wakes it, or the worker sees the task and doesn't sleep.
+  void Park(ThreadData &data) {
+    data.parked.store(1, std::memory_order_relaxed);
+    blocked_.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (done_ || cancelled_ || NonEmptyQueueIndex() != -1) {
+      data.parked.store(0, std::memory_order_relaxed);
+    } else {
+      Tracing::WorkerParked();
+      while (data.parked.load(std::memory_order_acquire) == 1) {
+        data.parked.wait(1, std::memory_order_acquire);
+      }
+    }
+    blocked_.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  bool Unpark(int thread_id) {
+    auto &parked = thread_data_[thread_id].parked;
+    if (parked.load(std::memory_order_relaxed) == 1 &&
+        parked.exchange(0, std::memory_order_acq_rel) == 1) {
+      parked.notify_one();
+      return true;
+    }
+    return false;
+  }
+
+  // Wakes up a worker after a task was pushed: the owner of the queue if it
+  // is parked (mailboxes can be private to it), any parked worker otherwise.
+  // Pass -1 when the task was pushed by its queue owner.
+  void Notify(int thread_id) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (blocked_.load(std::memory_order_acquire) == 0) [[likely]] {
+      return;
+    }
+    if (thread_id >= 0 && Unpark(thread_id)) {
+      return;
+    }
+    PerThread *pt = GetPerThread();
+    unsigned victim = Rand(&pt->rand) % num_threads_;
+    for (int i = 0; i < num_threads_; i++) {
+      if (Unpark(victim)) {
+        return;
+      }
+      if (++victim == static_cast<unsigned>(num_threads_)) {
+        victim = 0;
+      }
+    }
+  }
+
+  void UnparkAll() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (int i = 0; i < num_threads_; i++) {
+      Unpark(i);
+    }
+  }
+
   static __attribute__((always_inline)) inline uint64_t GlobalThreadIdHash() {
     return std::hash<std::thread::id>()(std::this_thread::get_id());
   }
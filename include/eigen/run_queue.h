@@ -142,7 +142,7 @@ public:
       } else {
         // Note: no need to store temporal kBusy, we exclusively own these
         // elements.
-        eigen_plain_assert(s == kReady);
+        assert(s == kReady);
       }
       result->push_back(std::move(e->w));
       e->state.store(kEmpty, std::memory_order_release);
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace Eigen {
+
+// TaskAllocator is a per-thread slab allocator for small scheduler objects
+// (tasks and task nodes). These objects are allocated on one worker and very
+// often freed on another one, which is the slow path of general purpose
+// allocators.
+//
+// Every thread owns a SlabCache with a free list per size class. Blocks are
+// prefixed with a header that remembers the owning cache:
+//   * a block freed by its owner goes back to the owner's free list,
+//   * a block freed by another thread is put into a local batch and the whole
+//     batch is pushed to the owner's remote stack with a single CAS once it
+//     is full (or the next block belongs to a different owner),
+//   * the owner grabs its remote stack at once when its free list runs out.
+// Slabs are never returned to the system: caches of exited threads are kept
+// in a global list and are adopted by new threads.
+//
+// Define EIGEN_POOL_SYSTEM_ALLOCATOR to use global operator new instead.
+class TaskAllocator {
+  static constexpr size_t kClasses = 4;
+  static constexpr size_t kMinBlockSize = 64;
+  static constexpr size_t kMaxBlockSize = kMinBlockSize << (kClasses - 1);
+  static constexpr size_t kSlabSize = size_t{64} * 1024;
+  static constexpr size_t kRemoteBatch = 32;
+
+  struct SlabCache;
+
+  struct alignas(16) Header {
+    SlabCache *Owner; // nullptr for blocks allocated by operator new
+    uint32_t Class;
+  };
+
+  // lives in the payload of a free block
+  struct FreeBlock {
+    FreeBlock *Next;
+  };
+
+  static_assert(sizeof(Header) == 16);
+
+  struct SlabCache {
+    FreeBlock *Free[kClasses] = {};
+    char *Bump[kClasses] = {};
+    char *BumpEnd[kClasses] = {};
+
+    // pending frees of blocks owned by PendingOwner
+    SlabCache *PendingOwner = nullptr;
+    FreeBlock *PendingHead = nullptr;
+    FreeBlock *PendingTail = nullptr;
+    size_t PendingCount = 0;
+
+    // blocks of this cache freed by other threads
+    alignas(128) std::atomic<FreeBlock *> Remote{nullptr};
+
+    void *Allocate(uint32_t cls) {
+      if (!Free[cls]) {
+        DrainRemote();
+      }
+      if (auto block = Free[cls]) {
+        Free[cls] = block->Next;
+        return block;
+      }
+      return Carve(cls);
+    }
+
+    void Deallocate(FreeBlock *block, SlabCache *owner) {
+      if (owner == this) {
+        auto cls = HeaderOf(block)->Class;
+        block->Next = Free[cls];
+        Free[cls] = block;
+        return;
+      }
+      if (owner != PendingOwner) {
+        FlushPending();
+        PendingOwner = owner;
+      }
+      block->Next = PendingHead;
+      PendingHead = block;
+      if (!PendingTail) {
+        PendingTail = block;
+      }
+      if (++PendingCount == kRemoteBatch) {
+        FlushPending();
+      }
+    }
+
+    void FlushPending() {
+      if (PendingHead) {
+        PushRemote(PendingOwner, PendingHead, PendingTail);
+      }
+      PendingOwner = nullptr;
+      PendingHead = PendingTail = nullptr;
+      PendingCount = 0;
+    }
+
+    void DrainRemote() {
+      if (!Remote.load(std::memory_order_relaxed)) {
+        return;
+      }
+      auto block = Remote.exchange(nullptr, std::memory_order_acquire);
+      while (block) {
+        auto next = block->Next;
+        auto cls = HeaderOf(block)->Class;
+        block->Next = Free[cls];
+        Free[cls] = block;
+        block = next;
+      }
+    }
+
+  private:
+    void *Carve(uint32_t cls) {
+      const size_t blockSize = kMinBlockSize << cls;
+      if (Bump[cls] == BumpEnd[cls]) {
+        Bump[cls] = static_cast<char *>(::operator new(kSlabSize));
+        BumpEnd[cls] = Bump[cls] + kSlabSize / blockSize * blockSize;
+      }
+      auto header = new (Bump[cls]) Header{this, cls};
+      Bump[cls] += blockSize;
+      return header + 1;
+    }
+  };
+
+public:
+  static void *Allocate(size_t size) {
+    auto cache = LocalCache();
+    if (!cache || size > kMaxBlockSize - sizeof(Header)) {
+      auto header = new (::operator new(sizeof(Header) + size))
+          Header{nullptr, kClasses};
+      return header + 1;
+    }
+    return cache->Allocate(SizeClass(size));
+  }
+
+  static void Deallocate(void *p) noexcept {
+    if (!p) {
+      return;
+    }
+    auto header = static_cast<Header *>(p) - 1;
+    auto owner = header->Owner;
+    if (!owner) {
+      ::operator delete(header);
+      return;
+    }
+    auto block = static_cast<FreeBlock *>(p);
+    if (auto cache = LocalCache()) {
+      cache->Deallocate(block, owner);
+    } else {
+      // thread is exiting, no batching
+      PushRemote(owner, block, block);
+    }
+  }
+
+  // Pushes pending remote frees of the calling thread to their owner.
+  static void Flush() {
+    if (auto cache = LocalCache()) {
+      cache->FlushPending();
+    }
+  }
+
+private:
+  static Header *HeaderOf(FreeBlock *block) {
+    return reinterpret_cast<Header *>(block) - 1;
+  }
+
+  static uint32_t SizeClass(size_t size) {
+    uint32_t cls = 0;
+    while ((kMinBlockSize << cls) - sizeof(Header) < size) {
+      ++cls;
+    }
+    return cls;
+  }
+
+  static void PushRemote(SlabCache *owner, FreeBlock *head, FreeBlock *tail) {
+    auto top = owner->Remote.load(std::memory_order_relaxed);
+    do {
+      tail->Next = top;
+    } while (!owner->Remote.compare_exchange_weak(
+        top, head, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  struct Orphans {
+    std::mutex Mutex;
+    std::vector<SlabCache *> Caches;
+  };
+
+  static Orphans &GetOrphans() {
+    // never destroyed: pool threads can exit during static destruction
+    static auto orphans = new Orphans;
+    return *orphans;
+  }
+
+  struct CacheHolder {
+    CacheHolder() {
+      auto &orphans = GetOrphans();
+      {
+        std::lock_guard<std::mutex> lock(orphans.Mutex);
+        if (!orphans.Caches.empty()) {
+          Cache = orphans.Caches.back();
+          orphans.Caches.pop_back();
+        }
+      }
+      if (!Cache) {
+        Cache = new SlabCache;
+      }
+    }
+
+    ~CacheHolder() {
+      Cache->FlushPending();
+      auto &orphans = GetOrphans();
+      std::lock_guard<std::mutex> lock(orphans.Mutex);
+      orphans.Caches.push_back(Cache);
+      Exited() = true;
+    }
+
+    SlabCache *Cache = nullptr;
+  };
+
+  static bool &Exited() {
+    static thread_local bool exited = false;
+    return exited;
+  }
+
+  // Returns nullptr once the cache of the calling thread is released.
+  static SlabCache *LocalCache() {
+    if (Exited()) {
+      return nullptr;
+    }
+    static thread_local CacheHolder holder;
+    return holder.Cache;
+  }
+};
+
+// Base for scheduler objects that should be allocated by TaskAllocator.
+struct TaskAllocated {
+#ifndef EIGEN_POOL_SYSTEM_ALLOCATOR
+  static void *operator new(std::size_t size) {
+    return TaskAllocator::Allocate(size);
+  }
+
+  static void operator delete(void *p) noexcept {
+    TaskAllocator::Deallocate(p);
+  }
+
+  // over-aligned objects are rare, leave them to the global allocator
+  static void *operator new(std::size_t size, std::align_val_t align) {
+    return ::operator new(size, align);
+  }
+
+  static void operator delete(void *p, std::align_val_t align) noexcept {
+    ::operator delete(p, align);
+  }
+#endif
+};
+
+} // namespace Eigen
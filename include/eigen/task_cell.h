@@ -0,0 +1,100 @@
+#pragma once
+
+#include "task_allocator.h"
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Eigen {
+
+// Closures that can be moved with memcpy and then used without running the
+// destructor of the source. Trivially copyable types are relocatable, other
+// types (e.g. tasks holding an IntrusivePtr) opt in by specializing the trait.
+template <typename T>
+struct IsTriviallyRelocatable : std::is_trivially_copyable<T> {};
+
+// TaskCell is a fixed-size type-erased closure that is stored by value in the
+// pool queues. Closures that fit into the cell and are trivially relocatable
+// are stored inline, so scheduling them needs neither an allocation nor a
+// virtual call. Other closures are boxed on the heap (see TaskAllocator).
+//
+// The cell itself is trivially copyable: queues move it around with plain
+// copies, the copy left in a queue slot is dead and is never run. A cell runs
+// its closure at most once, operator() destroys the closure and empties the
+// cell; Reset destroys the closure without running it.
+class TaskCell {
+public:
+  static constexpr size_t kSize = 128;
+  static constexpr size_t kAlignment = 16;
+  static constexpr size_t kBufferSize = kSize - kAlignment;
+
+  template <typename F>
+  static constexpr bool IsInline =
+      sizeof(F) <= kBufferSize && alignof(F) <= kAlignment &&
+      IsTriviallyRelocatable<F>::value;
+
+  TaskCell() = default;
+
+  template <typename F, typename = std::enable_if_t<
+                            !std::is_same_v<std::decay_t<F>, TaskCell>>>
+  explicit TaskCell(F &&f) {
+    using Func = std::decay_t<F>;
+    if constexpr (IsInline<Func>) {
+      new (buffer_) Func(std::forward<F>(f));
+      manage_ = &ManageInline<Func>;
+    } else {
+      auto box = new Box<Func>{{}, std::forward<F>(f)};
+      new (buffer_) Box<Func> *(box);
+      manage_ = &ManageBoxed<Func>;
+    }
+  }
+
+  explicit operator bool() const { return manage_ != nullptr; }
+
+  void operator()() {
+    auto manage = manage_;
+    manage_ = nullptr;
+    manage(Op::RUN, buffer_);
+  }
+
+  void Reset() {
+    if (manage_) {
+      auto manage = manage_;
+      manage_ = nullptr;
+      manage(Op::DESTROY, buffer_);
+    }
+  }
+
+private:
+  enum class Op { RUN, DESTROY };
+
+  template <typename Func> struct Box : TaskAllocated {
+    Func F;
+  };
+
+  template <typename Func> static void ManageInline(Op op, void *buffer) {
+    auto f = std::launder(reinterpret_cast<Func *>(buffer));
+    if (op == Op::RUN) {
+      (*f)();
+    }
+    f->~Func();
+  }
+
+  template <typename Func> static void ManageBoxed(Op op, void *buffer) {
+    auto box = *std::launder(reinterpret_cast<Box<Func> **>(buffer));
+    if (op == Op::RUN) {
+      box->F();
+    }
+    delete box;
+  }
+
+  void (*manage_)(Op, void *) = nullptr;
+  alignas(kAlignment) unsigned char buffer_[kBufferSize];
+};
+
+static_assert(sizeof(TaskCell) == TaskCell::kSize);
+static_assert(std::is_trivially_copyable_v<TaskCell>);
+
+} // namespace Eigen
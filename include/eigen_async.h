@@ -0,0 +1,233 @@
+#pragma once
+
+#include "eigen_pool.h"
+#include "intrusive_ptr.h"
+#include "timespan_partitioner.h"
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Coroutines on top of the Eigen pool. A coroutine moves to a worker with
+// co_await EigenPoolWrapper{}.schedule(), which pushes its continuation
+// through the usual queues, so it is shared and stolen like any other task.
+// Task<T> is lazy: it starts when it is awaited and resumes the awaiting
+// coroutine on the thread it finishes on. when_all runs tasks concurrently
+// and resumes the caller once the last one is done, without blocking a
+// worker; sync_wait is the way in from code that isn't a coroutine.
+namespace EigenAsync {
+
+template <typename T = void> class [[nodiscard]] Task;
+
+namespace detail {
+
+// Coroutine frames are created on one worker and often destroyed on
+// another, like pool tasks, so they come from the same allocator.
+struct PromiseBase : Eigen::TaskAllocated {
+  struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+
+    template <typename Promise>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+      return handle.promise().Continuation;
+    }
+
+    void await_resume() const noexcept {}
+  };
+
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  FinalAwaiter final_suspend() const noexcept { return {}; }
+  void unhandled_exception() const noexcept { std::terminate(); }
+
+  std::coroutine_handle<> Continuation = std::noop_coroutine();
+};
+
+template <typename T> struct Promise : PromiseBase {
+  Task<T> get_return_object() {
+    return Task<T>{std::coroutine_handle<Promise>::from_promise(*this)};
+  }
+
+  template <typename U> void return_value(U &&value) {
+    Value.emplace(std::forward<U>(value));
+  }
+
+  T Result() { return std::move(*Value); }
+
+  std::optional<T> Value;
+};
+
+template <> struct Promise<void> : PromiseBase {
+  Task<void> get_return_object();
+
+  void return_void() const noexcept {}
+
+  void Result() const noexcept {}
+};
+
+} // namespace detail
+
+template <typename T> class [[nodiscard]] Task {
+public:
+  using promise_type = detail::Promise<T>;
+
+  Task() = default;
+  explicit Task(std::coroutine_handle<promise_type> handle)
+      : Handle_(handle) {}
+
+  Task(Task &&other) noexcept : Handle_(std::exchange(other.Handle_, {})) {}
+
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      Reset();
+      Handle_ = std::exchange(other.Handle_, {});
+    }
+    return *this;
+  }
+
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+
+  ~Task() { Reset(); }
+
+  // Runs the task on the awaiting thread, the awaiter is resumed where the
+  // task finishes.
+  auto operator co_await() && noexcept {
+    struct Awaiter {
+      std::coroutine_handle<promise_type> Handle;
+
+      bool await_ready() const noexcept { return false; }
+
+      std::coroutine_handle<>
+      await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        Handle.promise().Continuation = awaiter;
+        return Handle;
+      }
+
+      T await_resume() { return Handle.promise().Result(); }
+    };
+    return Awaiter{Handle_};
+  }
+
+private:
+  void Reset() {
+    if (Handle_) {
+      Handle_.destroy();
+      Handle_ = {};
+    }
+  }
+
+  std::coroutine_handle<promise_type> Handle_;
+};
+
+inline Task<void> detail::Promise<void>::get_return_object() {
+  return Task<void>{std::coroutine_handle<Promise>::from_promise(*this)};
+}
+
+namespace detail {
+
+// Starts right away and destroys itself when it's done.
+struct Detached {
+  struct promise_type : Eigen::TaskAllocated {
+    Detached get_return_object() const noexcept { return {}; }
+    std::suspend_never initial_suspend() const noexcept { return {}; }
+    std::suspend_never final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    void unhandled_exception() const noexcept { std::terminate(); }
+  };
+};
+
+template <typename T>
+using Slot = std::optional<std::conditional_t<std::is_void_v<T>, bool, T>>;
+
+template <typename T> auto AwaitInto(Task<T> task, Slot<T> &slot) -> Task<> {
+  if constexpr (std::is_void_v<T>) {
+    co_await std::move(task);
+    slot.emplace(true);
+  } else {
+    slot.emplace(co_await std::move(task));
+  }
+}
+
+// The frame holds a reference to the node until the task is done, see
+// sync_wait.
+template <typename T>
+Detached RunAndRelease(Task<T> task, Slot<T> &slot,
+                       IntrusivePtr<EigenPartitioner::TaskNode> node) {
+  co_await AwaitInto(std::move(task), slot);
+}
+
+struct WhenAllState {
+  std::atomic<size_t> Pending;
+  std::coroutine_handle<> Awaiter;
+};
+
+template <typename T>
+Detached RunChild(Task<T> task, Slot<T> &slot, WhenAllState &state) {
+  co_await EigenPoolWrapper{}.schedule();
+  co_await AwaitInto(std::move(task), slot);
+  // the state lives in the frame of the awaiter, it is not touched after
+  if (state.Pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    state.Awaiter.resume();
+  }
+}
+
+template <typename T> struct WhenAllAwaiter {
+  std::vector<Task<T>> &Tasks;
+  std::vector<Slot<T>> &Slots;
+  WhenAllState State{};
+
+  bool await_ready() const noexcept { return Tasks.empty(); }
+
+  bool await_suspend(std::coroutine_handle<> awaiter) {
+    State.Awaiter = awaiter;
+    // one more for this thread, so the last child can't resume the awaiter
+    // while the rest are still being started
+    State.Pending.store(Tasks.size() + 1, std::memory_order_relaxed);
+    for (size_t i = 0; i != Tasks.size(); ++i) {
+      RunChild(std::move(Tasks[i]), Slots[i], State);
+    }
+    return State.Pending.fetch_sub(1, std::memory_order_acq_rel) != 1;
+  }
+
+  void await_resume() const noexcept {}
+};
+
+} // namespace detail
+
+// Runs all tasks concurrently on the pool, the result keeps their order.
+template <typename T>
+auto when_all(std::vector<Task<T>> tasks)
+    -> Task<std::conditional_t<std::is_void_v<T>, void, std::vector<T>>> {
+  std::vector<detail::Slot<T>> slots(tasks.size());
+  co_await detail::WhenAllAwaiter<T>{tasks, slots};
+  if constexpr (!std::is_void_v<T>) {
+    std::vector<T> results;
+    results.reserve(slots.size());
+    for (auto &slot : slots) {
+      results.push_back(std::move(*slot));
+    }
+    co_return results;
+  }
+}
+
+// Runs the task and waits for it like ParallelDo waits for its branch:
+// workers execute other tasks meanwhile, other threads block.
+template <typename T> T sync_wait(Task<T> task) {
+  EigenPoolWrapper sched;
+  EigenPartitioner::TaskNode rootNode;
+  IntrusivePtrAddRef(&rootNode); // avoid deletion
+  detail::Slot<T> slot;
+  detail::RunAndRelease(std::move(task), slot, IntrusivePtr{&rootNode});
+  EigenPartitioner::detail::Join(sched, rootNode);
+  if constexpr (!std::is_void_v<T>) {
+    return std::move(*slot);
+  }
+}
+
+} // namespace EigenAsync
@@ -9,11 +9,11 @@ struct EigenPinner {
     // use ptr because we want to wait for all threads in other threads
     auto barrier = std::make_shared<SpinBarrier>(threadsNum - 1);
     for (size_t i = 1; i < threadsNum; ++i) { // don't pin main thread
-      EigenPool().RunOnThread(Eigen::MakeTask([barrier, i]() {
+      EigenPool().RunOnThread(Eigen::TaskCell{[barrier, i]() {
                               PinThread(i);
                               barrier->Notify();
                               barrier->Wait();
-                            }),
+                            }},
                             i);
     }
     PinThread(0);
@@ -1,6 +1,7 @@
 #pragma once
 #include "modes.h"
 #include "num_threads.h"
+#include "topology.h"
 
 #ifdef EIGEN_MODE
 
@@ -8,29 +9,171 @@
 #include "eigen/nonblocking_thread_pool.h"
 #include "tracing.h"
 
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// EigenArena is an isolated pool: it has its own workers, cpus and steal
+// domains, so loops of one arena never land in the queues of another one.
+// Workers of an arena created by the user are dedicated threads unless it
+// takes the creating thread as worker 0; dedicated workers are pinned to the
+// given cpus (worker i to cpus[i]) if there are enough of them. The default
+// arena (see EigenPool) uses the main thread as worker 0 and is pinned by
+// EigenPinner.
+class EigenArena {
+public:
+  explicit EigenArena(size_t numThreads, std::vector<CpuInfo> cpus = {})
+      : EigenArena(numThreads, std::move(cpus), false) {}
+
+  // With useMainThread the constructing thread is worker 0, like the main
+  // thread in the default arena; it runs tasks only while it waits for them.
+  EigenArena(size_t numThreads, std::vector<CpuInfo> cpus, bool useMainThread)
+      : pool_(numThreads, true, useMainThread) {
+    pool_.SetStealDomains(GetStealDomains(cpus, numThreads));
+    if (const char *envSpin = std::getenv("BENCH_SPIN_COUNT")) {
+      pool_.SetSpinCount(std::stoul(envSpin));
+    }
+    if (const char *envStealHalf = std::getenv("BENCH_STEAL_HALF")) {
+      pool_.SetStealHalf(std::stoi(envStealHalf) != 0);
+    }
+    if (!useMainThread && numThreads <= cpus.size()) {
+      Pin(cpus);
+    }
+  }
+
+  EigenArena(const EigenArena &) = delete;
+  EigenArena &operator=(const EigenArena &) = delete;
+
+  Eigen::ThreadPool &Pool() { return pool_; }
+
+  size_t NumThreads() const { return pool_.NumThreads(); }
+
+  // Initial timespan of TIMESPAN balancing on this arena, computed by
+  // compute() on the first call (see EigenPartitioner::detail::InitTime).
+  template <typename F> uint64_t Timespan(F &&compute) {
+    if (auto timespan = timespan_.load(std::memory_order_acquire)) {
+      return timespan;
+    }
+    std::call_once(timespanOnce_, [&]() {
+      timespan_.store(compute(), std::memory_order_release);
+    });
+    return timespan_.load(std::memory_order_acquire);
+  }
+
+  static EigenArena &Default() {
+    static EigenArena arena(GetNumThreads(), Topology::Get().Cpus, true);
+    return arena;
+  }
+
+private:
+  void Pin(const std::vector<CpuInfo> &cpus) {
+    // every worker keeps its task until all of them are pinned, so each task
+    // is run by a different worker (tasks can be stolen)
+    auto remain = std::make_shared<std::atomic<size_t>>(NumThreads());
+    for (size_t i = 0; i != NumThreads(); ++i) {
+      pool_.RunOnThread(Eigen::TaskCell{[this, remain, &cpus]() {
+                          PinThreadToCpu(cpus[pool_.CurrentThreadId()].Id);
+                          remain->fetch_sub(1);
+                          while (remain->load()) {
+                            std::this_thread::yield();
+                          }
+                        }},
+                        i);
+    }
+    while (remain->load()) {
+      std::this_thread::yield();
+    }
+  }
+
+  Eigen::ThreadPool pool_;
+  std::once_flag timespanOnce_;
+  std::atomic<uint64_t> timespan_{0};
+};
+
 inline Eigen::ThreadPool& EigenPool() {
-  static auto pool = Eigen::ThreadPool(GetNumThreads(), true, true); 
-  return pool;
+  // workers are pinned in topology order (see EigenPinner)
+  return EigenArena::Default().Pool();
 }
 
+// Scheduler of the partitioner, submits tasks to the default arena or to the
+// given one.
 class EigenPoolWrapper {
 public:
-  template <typename F> void run(F &&f) {
-    EigenPool().Schedule(Eigen::MakeTask(std::forward<F>(f)));
+  EigenPoolWrapper() : EigenPoolWrapper(EigenArena::Default()) {}
+  explicit EigenPoolWrapper(EigenArena &arena)
+      : arena_(&arena), pool_(&arena.Pool()) {}
+
+  EigenArena &arena() const { return *arena_; }
+
+  template <typename F>
+  void run(F &&f, Eigen::Priority priority = Eigen::Priority::NORMAL) {
+    pool_->Schedule(Eigen::TaskCell{std::forward<F>(f)}, priority);
   }
 
-  template <typename F> void run_on_thread(F &&f, size_t hint) {
-    auto task = Eigen::MakeProxyTask(std::forward<F>(f));
+  // The task is pushed once, to the mailbox of the hinted thread. Mailboxes
+  // are stealable, so it is claimed exactly once: by the hinted thread or by
+  // a thief, whoever pops it first.
+  template <typename F>
+  void run_on_thread(F &&f, size_t hint,
+                     Eigen::Priority priority = Eigen::Priority::NORMAL) {
     Eigen::Tracing::TaskShared();
-    EigenPool().RunOnThread(task, hint);
-    EigenPool().Schedule(task); // might push twice to the same thread, OK for now
+    pool_->RunOnThread(Eigen::TaskCell{std::forward<F>(f)}, hint, priority);
+  }
+
+  // co_await sched.schedule() suspends the coroutine and resumes it as a task
+  // of the pool, see eigen_async.h.
+  auto schedule(Eigen::Priority priority = Eigen::Priority::NORMAL) {
+    struct Awaiter {
+      Eigen::ThreadPool *pool;
+      Eigen::Priority priority;
+
+      bool await_ready() const noexcept { return false; }
+
+      void await_suspend(std::coroutine_handle<> handle) {
+        pool->Schedule(Eigen::TaskCell{[handle]() { handle.resume(); }},
+                       priority);
+      }
+
+      void await_resume() const noexcept {}
+    };
+    return Awaiter{pool_, priority};
   }
 
-  bool join_main_thread() { return EigenPool().JoinMainThread(); }
+  bool join_main_thread() { return pool_->JoinMainThread(); }
+
+  // true for threads of the pool, they can help to execute tasks
+  bool is_worker() const { return pool_->CurrentThreadId() != -1; }
+
+  unsigned spin_count() const { return pool_->SpinCount(); }
 
   bool execute_something_else() {
-    return EigenPool().TryExecuteSomething();
+    return pool_->TryExecuteSomething();
+  }
+
+  // Frames of Spawn, callable by workers of the pool only.
+  bool push_frame(Eigen::SpawnedFrame *frame) {
+    return pool_->PushFrame(frame);
   }
+
+  Eigen::SpawnedFrame *pop_frame() { return pool_->PopFrame(); }
+
+  bool execute_as_guest() { return pool_->TryExecuteAsGuest(); }
+
+  size_t num_threads() const { return pool_->NumThreads(); }
+
+  // false if the arena has a worker for every thread slot, then a thread
+  // outside of it submits the whole loop instead of running a part inline
+  bool uses_main_thread() const { return pool_->UsesMainThread(); }
+
+private:
+  EigenArena *arena_;
+  Eigen::ThreadPool *pool_;
 };
 
 #endif
@@ -117,6 +117,9 @@ template <typename T> struct intrusive_ref_counter {
   template <typename D>
   friend void IntrusivePtrRelease(const intrusive_ref_counter<D> *p) noexcept;
 
+  template <typename D>
+  friend void IntrusivePtrWaitUnique(const intrusive_ref_counter<D> *p) noexcept;
+
   intrusive_ref_counter() noexcept : m_cnt(0) {}
 
   intrusive_ref_counter(const intrusive_ref_counter &) noexcept : m_cnt(0) {}
@@ -125,18 +128,23 @@ template <typename T> struct intrusive_ref_counter {
     return *this;
   }
 
-  unsigned int use_count() const noexcept { return m_cnt; }
+  unsigned int use_count() const noexcept { return m_cnt & ~kWaiting; }
 
 protected:
   ~intrusive_ref_counter() = default;
 
 private:
+  // set in m_cnt while some thread is blocked in IntrusivePtrWaitUnique
+  static constexpr std::size_t kWaiting = std::size_t{1}
+                                          << (sizeof(std::size_t) * 8 - 1);
+
   mutable std::atomic<std::size_t> m_cnt{0};
 };
 
 template <class Derived>
 std::size_t IntrusivePtrLoadRef(const intrusive_ref_counter<Derived> *p) noexcept {
-  return p->m_cnt.load(std::memory_order_acquire);
+  return p->m_cnt.load(std::memory_order_acquire) &
+         ~intrusive_ref_counter<Derived>::kWaiting;
 }
 
 template <class Derived>
@@ -146,7 +154,31 @@ void IntrusivePtrAddRef(const intrusive_ref_counter<Derived> *p) noexcept {
 
 template <class Derived>
 void IntrusivePtrRelease(const intrusive_ref_counter<Derived> *p) noexcept {
-  if (p->m_cnt.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+  constexpr auto kWaiting = intrusive_ref_counter<Derived>::kWaiting;
+  auto prev = p->m_cnt.fetch_sub(1, std::memory_order_acq_rel);
+  if (prev == 1) {
     delete static_cast<const Derived *>(p);
+  } else if (prev == (kWaiting | 2)) {
+    // the waiter holds the last reference now; it can destroy p as soon as
+    // it sees the new count, notify only uses the address
+    p->m_cnt.notify_all();
+  }
+}
+
+// Blocks until the caller holds the only reference to p. The caller must
+// own a reference that is not released concurrently.
+template <class Derived>
+void IntrusivePtrWaitUnique(const intrusive_ref_counter<Derived> *p) noexcept {
+  constexpr auto kWaiting = intrusive_ref_counter<Derived>::kWaiting;
+  if (IntrusivePtrLoadRef(p) == 1) {
+    return;
+  }
+  // Release sees the flag if it makes the count 1 after this fetch_or,
+  // otherwise the count is already 1 here.
+  auto cnt = p->m_cnt.fetch_or(kWaiting, std::memory_order_acq_rel) | kWaiting;
+  while (cnt != (kWaiting | 1)) {
+    p->m_cnt.wait(cnt, std::memory_order_acquire);
+    cnt = p->m_cnt.load(std::memory_order_acquire);
   }
+  p->m_cnt.fetch_and(~kWaiting, std::memory_order_relaxed);
 }
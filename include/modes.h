@@ -37,6 +37,8 @@ inline std::string GetParallelMode() {
 #define EIGEN_SHARING 2
 #define EIGEN_STEALING_GRAINSIZE 3
 #define EIGEN_SHARING_STEALING 4
+#define EIGEN_SHARING_LAZY 5
+#define EIGEN_HEARTBEAT 6
 
 #define TASKFLOW_GUIDED 1
 #define TASKFLOW_DYNAMIC 2
@@ -1,12 +1,12 @@
 #pragma once
 
 #include "modes.h"
+#include "topology.h"
 #include <cstddef>
 #include <string>
 #include <thread>
 
 inline int GetNumThreads() {
-  // TODO(blonded04): actually you need a way to programmatically find number of cores on 1 NUMA node
   static int result = [] {
     if (const char *envThreads = std::getenv("BENCH_NUM_THREADS")) {
       return std::stoi(envThreads);
@@ -14,7 +14,8 @@ inline int GetNumThreads() {
     if (const char *envThreads = std::getenv("OMP_NUM_THREADS")) {
       return std::stoi(envThreads);
     }
-    return 24;
+    // physical cores of one NUMA node, see Topology::DefaultNumThreads
+    return static_cast<int>(Topology::Get().DefaultNumThreads());
   }();
   return result;
 }
@@ -1,14 +1,19 @@
 #pragma once
 
 #ifdef EIGEN_MODE
+#include "eigen_async.h"
 #include "eigen_pool.h"
+#include "task_graph.h"
 #include "timespan_partitioner.h"
 #endif
 #include "modes.h"
 #include "poor_barrier.h"
+#include "thread_index.h"
 #include "util.h"
 #include <vector>
 #include <algorithm>
+#include <mutex>
+#include <type_traits>
 #include <utility>
 #include <cstdio>
 #include <numeric>
@@ -136,6 +141,317 @@ void ParallelFor(size_t from, size_t to, Func &&func, size_t grainSize = 1) {
 #endif
 }
 
+// Same as ParallelFor, but func is called with chunks [begin, end) of
+// contiguous indices instead of a single index, so per-iteration bookkeeping
+// is paid once per chunk and the body can vectorize across iterations.
+// Backends that split the range themselves stop splitting at grainSize like
+// in ParallelFor, others get chunks of exactly grainSize indices.
+template <typename Func>
+void ParallelForRange(size_t from, size_t to, Func &&func,
+                      size_t grainSize = 1) {
+  if (from >= to) {
+    return;
+  }
+  grainSize = std::max(grainSize, size_t{1});
+#if defined(SERIAL)
+  func(from, to);
+#elif defined(TASKFLOW_MODE) || defined(HPX_MODE)
+  // partitioners of these backends hand out single indices, so they get the
+  // chunk indices
+  auto chunks = (to - from + grainSize - 1) / grainSize;
+  ParallelFor(0, chunks, [&](size_t chunk) {
+    auto begin = from + chunk * grainSize;
+    func(begin, std::min(to, begin + grainSize));
+  });
+#elif defined(TBB_MODE)
+  static tbb::task_group_context context(
+      tbb::task_group_context::bound,
+      tbb::task_group_context::default_traits |
+          tbb::task_group_context::concurrent_wait);
+#if TBB_MODE == TBB_SIMPLE
+  const tbb::simple_partitioner part;
+#elif TBB_MODE == TBB_AUTO
+  const tbb::auto_partitioner part;
+#elif TBB_MODE == TBB_AFFINITY
+  static tbb::affinity_partitioner part;
+#elif TBB_MODE == TBB_CONST_AFFINITY
+  tbb::affinity_partitioner part;
+#elif TBB_MODE == TBB_RAPID
+  // no partitioner
+#else
+  static_assert(false, "Wrong TBB_MODE mode");
+#endif
+#if TBB_MODE == TBB_RAPID
+  RapidGroup.parallel_ranges(from, to, [&](auto from, auto to, auto part) {
+    func(from, to);
+  });
+#else
+  tbb::parallel_for(
+      tbb::blocked_range(from, to, grainSize),
+      [&](const tbb::blocked_range<size_t> &range) {
+        func(range.begin(), range.end());
+      },
+      part, context);
+#endif
+#elif defined(OMP_MODE)
+  auto chunks = (to - from + grainSize - 1) / grainSize;
+#pragma omp parallel
+  {
+#if OMP_MODE == OMP_STATIC
+    // one contiguous block of chunks per thread, like schedule(static)
+    size_t threads = omp_get_num_threads();
+    size_t thread = omp_get_thread_num();
+    auto begin = from + chunks * thread / threads * grainSize;
+    auto end = std::min(to, from + chunks * (thread + 1) / threads * grainSize);
+    if (begin < end) {
+      func(begin, end);
+    }
+#else
+#if OMP_MODE == OMP_RUNTIME
+#pragma omp for schedule(runtime)
+#elif OMP_MODE == OMP_DYNAMIC_MONOTONIC
+#pragma omp for schedule(monotonic : dynamic)
+#elif OMP_MODE == OMP_DYNAMIC_NONMONOTONIC
+#pragma omp for schedule(nonmonotonic : dynamic)
+#elif OMP_MODE == OMP_GUIDED_MONOTONIC
+#pragma omp for schedule(monotonic : guided)
+#elif OMP_MODE == OMP_GUIDED_NONMONOTONIC
+#pragma omp for schedule(nonmonotonic : guided)
+#else
+    static_assert(false, "Wrong OMP_MODE mode");
+#endif
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+      auto begin = from + chunk * grainSize;
+      func(begin, std::min(to, begin + grainSize));
+    }
+#endif
+  }
+#elif defined(EIGEN_MODE)
+  EigenPartitioner::ParallelForRange(from, to, func, grainSize);
+#else
+  static_assert(false, "Wrong mode");
+#endif
+}
+
+// Rows or columns [From, To) of a ParallelFor2D tile.
+struct IndexRange {
+  size_t From;
+  size_t To;
+
+  size_t Size() const { return To - From; }
+};
+
+namespace detail {
+
+// Tiles of a grid are numbered in the order of recursive halving: a block
+// of tiles is split in two along its longer side, the first half is numbered
+// first. Calls func(rows, columns) with the smallest number of blocks that
+// cover tiles [from, to) of the block [rows) x [columns) whose first tile
+// number is first. Halving chunks of the partitioner are mostly whole
+// blocks, so most chunks are a single rectangle.
+template <typename Func>
+void VisitTiles(IndexRange rows, IndexRange columns, size_t first,
+                size_t from, size_t to, Func &func) {
+  auto count = rows.Size() * columns.Size();
+  if (to <= first || first + count <= from) {
+    return;
+  }
+  if (from <= first && first + count <= to) {
+    func(rows, columns);
+    return;
+  }
+  // partially covered, so it has more than one tile
+  if (rows.Size() >= columns.Size()) {
+    auto mid = rows.From + rows.Size() / 2;
+    VisitTiles({rows.From, mid}, columns, first, from, to, func);
+    VisitTiles({mid, rows.To}, columns,
+               first + (mid - rows.From) * columns.Size(), from, to, func);
+  } else {
+    auto mid = columns.From + columns.Size() / 2;
+    VisitTiles(rows, {columns.From, mid}, first, from, to, func);
+    VisitTiles(rows, {mid, columns.To},
+               first + rows.Size() * (mid - columns.From), from, to, func);
+  }
+}
+
+} // namespace detail
+
+// Two-dimensional loop over [0, rows) x [0, columns) in square tiles of the
+// given size: func(rowRange, columnRange) is called with rectangles of whole
+// tiles (cut at the borders of the grid). The tiles are handed to a single
+// ParallelForRange in the order of recursive halving along the longer side,
+// so a chunk of the partitioner is a compact block of the grid, and there is
+// one loop to split and join instead of one per row as with nested loops.
+template <typename Func>
+void ParallelFor2D(size_t rows, size_t columns, size_t tile, Func &&func) {
+  tile = std::max(tile, size_t{1});
+  const IndexRange rowTiles{0, (rows + tile - 1) / tile};
+  const IndexRange columnTiles{0, (columns + tile - 1) / tile};
+  auto body = [&](IndexRange blockRows, IndexRange blockColumns) {
+    func(IndexRange{blockRows.From * tile, std::min(rows, blockRows.To * tile)},
+         IndexRange{blockColumns.From * tile,
+                    std::min(columns, blockColumns.To * tile)});
+  };
+  ParallelForRange(0, rowTiles.Size() * columnTiles.Size(),
+                   [&](size_t from, size_t to) {
+                     detail::VisitTiles(rowTiles, columnTiles, 0, from, to,
+                                        body);
+                   });
+}
+
+// Partial result of a reduction, padded so that workers updating their
+// partials don't share cache lines. Fixed 128 (adjacent line prefetch) keeps
+// the layout independent of -mtune, unlike the std constant.
+template <typename T> struct alignas(128) ReducePartial {
+  T Value;
+};
+
+enum class ReduceMode {
+  // one partial per worker, the order of combines depends on scheduling, so
+  // combine must be commutative
+  FAST,
+  // fixed blocks combined by a fixed tree in index order: floating-point
+  // results are bit-identical across runs and numbers of threads, and
+  // combine only has to be associative
+  DETERMINISTIC,
+};
+
+// Block of DETERMINISTIC reductions unless the grain size is larger.
+inline constexpr size_t DeterministicReduceBlock = 2048;
+
+namespace detail {
+
+// map is either a range map, map(begin, end) -> T, or an index map,
+// map(i) -> T, whose results are combined from left to right.
+template <typename T, typename Map, typename Combine>
+T ReduceChunk(size_t from, size_t to, const T &identity, Map &map,
+              Combine &combine) {
+  if constexpr (std::is_invocable_v<Map &, size_t, size_t>) {
+    return map(from, to);
+  } else {
+    T acc = identity;
+    for (size_t i = from; i != to; ++i) {
+      acc = combine(std::move(acc), map(i));
+    }
+    return acc;
+  }
+}
+
+// Partials are indexed by workerId(), the id of the calling thread in the
+// pool that runs loop; the last partial is shared by threads outside of it.
+template <typename T, typename Map, typename Combine, typename Loop,
+          typename WorkerId>
+T ReduceFast(size_t from, size_t to, T identity, Map &map, Combine &combine,
+             size_t grainSize, size_t workers, Loop &&loop,
+             WorkerId &&workerId) {
+  std::vector<ReducePartial<T>> partials(workers + 1, {identity});
+  std::mutex foreignMutex;
+  loop(
+      from, to,
+      [&](size_t begin, size_t end) {
+        // the chunk is reduced before the partial is touched: a nested loop
+        // in map may run other chunks of this reduction on the same worker
+        auto chunk = ReduceChunk(begin, end, identity, map, combine);
+        auto index = static_cast<size_t>(workerId());
+        if (index < workers) {
+          auto &partial = partials[index].Value;
+          partial = combine(std::move(partial), std::move(chunk));
+        } else {
+          std::lock_guard<std::mutex> lock(foreignMutex);
+          auto &partial = partials[workers].Value;
+          partial = combine(std::move(partial), std::move(chunk));
+        }
+      },
+      grainSize);
+  T result = std::move(identity);
+  for (auto &partial : partials) {
+    result = combine(std::move(result), std::move(partial.Value));
+  }
+  return result;
+}
+
+template <typename T, typename Map, typename Combine, typename Loop>
+T ReduceDeterministic(size_t from, size_t to, const T &identity, Map &map,
+                      Combine &combine, size_t grainSize, Loop &&loop) {
+  auto blockSize = std::max(grainSize, DeterministicReduceBlock);
+  auto blocks = (to - from + blockSize - 1) / blockSize;
+  std::vector<ReducePartial<T>> partials(blocks, {identity});
+  loop(
+      0, blocks,
+      [&](size_t firstBlock, size_t lastBlock) {
+        for (size_t block = firstBlock; block != lastBlock; ++block) {
+          auto begin = from + block * blockSize;
+          partials[block].Value = ReduceChunk(
+              begin, std::min(to, begin + blockSize), identity, map, combine);
+        }
+      },
+      1);
+  // pairwise tree, its shape depends only on the number of blocks
+  for (size_t stride = 1; stride < blocks; stride *= 2) {
+    for (size_t i = 0; i + stride < blocks; i += 2 * stride) {
+      partials[i].Value =
+          combine(std::move(partials[i].Value), partials[i + stride].Value);
+    }
+  }
+  return std::move(partials[0].Value);
+}
+
+} // namespace detail
+
+#if defined(EIGEN_MODE)
+// Same as ParallelReduce below, on the workers of the given arena.
+template <typename T, typename Map, typename Combine>
+T ParallelReduce(EigenArena &arena, size_t from, size_t to, T identity,
+                 Map &&map, Combine &&combine, size_t grainSize = 1,
+                 ReduceMode mode = ReduceMode::FAST) {
+  if (from >= to) {
+    return identity;
+  }
+  auto loop = [&arena](size_t begin, size_t end, auto &&body, size_t grain) {
+    EigenPartitioner::ParallelFor(arena, begin, end, body, grain);
+  };
+  if (mode == ReduceMode::DETERMINISTIC) {
+    return detail::ReduceDeterministic(from, to, identity, map, combine,
+                                       grainSize, loop);
+  }
+  // GetThreadIndex() only knows the default pool
+  return detail::ReduceFast(
+      from, to, std::move(identity), map, combine, grainSize,
+      arena.NumThreads(), loop,
+      [&arena]() { return arena.Pool().CurrentThreadId(); });
+}
+#endif
+
+// Reduces map over [from, to) with an associative combine, identity is its
+// neutral element. In FAST mode chunks are combined into per-worker partials
+// indexed by the worker id, the partials are combined at the end: a worker
+// gets chunks in any order, so combine must also be commutative. A
+// non-commutative combine (concatenation, matrix product) needs
+// ReduceMode::DETERMINISTIC.
+template <typename T, typename Map, typename Combine>
+T ParallelReduce(size_t from, size_t to, T identity, Map &&map,
+                 Combine &&combine, size_t grainSize = 1,
+                 ReduceMode mode = ReduceMode::FAST) {
+#if defined(EIGEN_MODE)
+  return ParallelReduce(EigenArena::Default(), from, to, std::move(identity),
+                        map, combine, grainSize, mode);
+#else
+  if (from >= to) {
+    return identity;
+  }
+  auto loop = [](size_t begin, size_t end, auto &&body, size_t grain) {
+    ParallelForRange(begin, end, body, grain);
+  };
+  if (mode == ReduceMode::DETERMINISTIC) {
+    return detail::ReduceDeterministic(from, to, identity, map, combine,
+                                       grainSize, loop);
+  }
+  return detail::ReduceFast(from, to, std::move(identity), map, combine,
+                            grainSize, GetNumThreads(), loop,
+                            []() { return GetThreadIndex(); });
+#endif
+}
+
 inline void Warmup(size_t threadsNum) {
   SpinBarrier barrier(threadsNum);
   ParallelFor(0, threadsNum, [&barrier](size_t) {
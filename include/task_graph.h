@@ -0,0 +1,122 @@
+#pragma once
+
+#include "eigen_pool.h"
+#include "intrusive_ptr.h"
+#include "thread_index.h"
+#include "timespan_partitioner.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace EigenPartitioner {
+
+// Static graph of tasks with dependencies: nodes and edges are added once,
+// then Run() executes the whole graph, as many times as needed.
+//
+// Every node counts its unfinished predecessors, the predecessor that brings
+// the counter to zero makes the node ready. Ready nodes with a thread hint
+// are pushed with run_on_thread to that thread, so the data a node works on
+// can stay in the caches of one thread from run to run. One ready node
+// without a hint (or hinted to the current thread) runs right after its
+// predecessor on the same thread, others are scheduled as usual.
+class TaskGraph {
+public:
+  using NodeId = size_t;
+  static constexpr size_t NoHint = static_cast<size_t>(-1);
+
+  TaskGraph() {
+    IntrusivePtrAddRef(&RootNode_); // avoid deletion
+  }
+
+  TaskGraph(const TaskGraph &) = delete;
+  TaskGraph &operator=(const TaskGraph &) = delete;
+
+  template <typename F> NodeId AddNode(F &&func, size_t threadHint = NoHint) {
+    auto &node = Nodes_.emplace_back();
+    node.Func = std::forward<F>(func);
+    node.ThreadHint = threadHint;
+    return Nodes_.size() - 1;
+  }
+
+  // to starts once from is done
+  void AddEdge(NodeId from, NodeId to) {
+    assert(from < Nodes_.size() && to < Nodes_.size() && from != to);
+    Nodes_[from].Successors.push_back(to);
+    ++Nodes_[to].Predecessors;
+  }
+
+  size_t Size() const { return Nodes_.size(); }
+
+  // Runs every node once and returns when all of them are done. The graph
+  // must be acyclic, it can't be changed or run again until Run returns.
+  void Run() {
+    for (auto &node : Nodes_) {
+      node.Pending.store(node.Predecessors, std::memory_order_relaxed);
+    }
+    for (NodeId id = 0; id != Nodes_.size(); ++id) {
+      if (Nodes_[id].Predecessors == 0) {
+        Dispatch(id);
+      }
+    }
+    detail::Join(Sched_, RootNode_);
+  }
+
+private:
+  struct Node {
+    std::function<void()> Func;
+    std::vector<NodeId> Successors;
+    size_t Predecessors = 0;
+    size_t ThreadHint = NoHint;
+    // predecessors that are not done yet in the current run
+    std::atomic<size_t> Pending{0};
+  };
+
+  void Dispatch(NodeId id) {
+    auto task = detail::WrapAsOwningTask([this, id]() { Execute(id); },
+                                         IntrusivePtr{&RootNode_});
+    auto hint = Nodes_[id].ThreadHint;
+    if (hint == NoHint) {
+      Sched_.run(std::move(task));
+    } else {
+      Sched_.run_on_thread(std::move(task), hint);
+    }
+  }
+
+  void Execute(NodeId id) {
+    const auto current = static_cast<size_t>(GetThreadIndex());
+    while (true) {
+      auto &node = Nodes_[id];
+      node.Func();
+      auto next = NoHint;
+      for (auto successorId : node.Successors) {
+        auto &successor = Nodes_[successorId];
+        // acq_rel: the last predecessor sees the writes of all others
+        if (successor.Pending.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+          continue;
+        }
+        if (next == NoHint && (successor.ThreadHint == NoHint ||
+                               successor.ThreadHint == current)) {
+          next = successorId;
+        } else {
+          Dispatch(successorId);
+        }
+      }
+      if (next == NoHint) {
+        return;
+      }
+      id = next;
+    }
+  }
+
+  // std::deque keeps nodes in place, atomics can't be moved
+  std::deque<Node> Nodes_;
+  EigenPoolWrapper Sched_;
+  TaskNode RootNode_;
+};
+
+} // namespace EigenPartitioner
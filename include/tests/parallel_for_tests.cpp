@@ -1,8 +1,11 @@
 
 #include "../parallel_for.h"
 #include <atomic>
+#include <functional>
 #include <gtest/gtest.h>
+#include <numeric>
 #include <random>
+#include <string>
 
 TEST(ParallelFor, Basic) {
   std::atomic<int> sum(0);
@@ -30,6 +33,104 @@ TEST(ParallelFor, ConcurrentCalls) {
   EXPECT_EQ(1024 * 1024 * maxThreads, sum);
 }
 
+TEST(ParallelFor, Range) {
+  // chunks cover every index exactly once
+  for (size_t grain : {1, 7, 64}) {
+    std::vector<std::atomic<int>> visited(1000);
+    ParallelForRange(
+        10, visited.size(),
+        [&](size_t from, size_t to) {
+          ASSERT_LT(from, to);
+          for (size_t i = from; i != to; ++i) {
+            visited[i]++;
+          }
+        },
+        grain);
+    for (size_t i = 0; i != visited.size(); ++i) {
+      EXPECT_EQ(i >= 10, visited[i]) << i;
+    }
+  }
+}
+
+TEST(ParallelFor, For2D) {
+  // tiles cover every cell exactly once, rectangles are cut at the borders
+  constexpr size_t Rows = 37;
+  constexpr size_t Columns = 100;
+  for (size_t tile : {1, 8, 64}) {
+    std::vector<std::atomic<int>> visited(Rows * Columns);
+    ParallelFor2D(Rows, Columns, tile, [&](IndexRange rows, IndexRange columns) {
+      ASSERT_LT(rows.From, rows.To);
+      ASSERT_LE(rows.To, Rows);
+      ASSERT_LT(columns.From, columns.To);
+      ASSERT_LE(columns.To, Columns);
+      EXPECT_EQ(0, rows.From % tile);
+      EXPECT_EQ(0, columns.From % tile);
+      for (size_t i = rows.From; i != rows.To; ++i) {
+        for (size_t j = columns.From; j != columns.To; ++j) {
+          visited[i * Columns + j]++;
+        }
+      }
+    });
+    for (size_t i = 0; i != visited.size(); ++i) {
+      EXPECT_EQ(1, visited[i]) << i;
+    }
+  }
+}
+
+TEST(ParallelFor, Reduce) {
+  constexpr size_t Size = 100000;
+  auto sum = ParallelReduce(
+      0, Size, size_t{0}, [](size_t i) { return i; }, std::plus<>{});
+  EXPECT_EQ(Size * (Size - 1) / 2, sum);
+  auto rangeSum = ParallelReduce(
+      10, Size, size_t{0},
+      [](size_t from, size_t to) {
+        size_t sum = 0;
+        for (size_t i = from; i != to; ++i) {
+          sum += i;
+        }
+        return sum;
+      },
+      std::plus<>{}, 64);
+  EXPECT_EQ(Size * (Size - 1) / 2 - 45, rangeSum);
+  EXPECT_EQ(7, ParallelReduce(5, 5, 7, [](size_t i) { return 0; },
+                              std::plus<>{}));
+}
+
+TEST(ParallelFor, ReduceDeterministic) {
+  // floating-point sum doesn't depend on the schedule
+  std::vector<double> data(1 << 20);
+  std::default_random_engine rnd{42};
+  std::uniform_real_distribution<double> values(-1e9, 1e9);
+  for (auto &x : data) {
+    x = values(rnd);
+  }
+  auto reduce = [&]() {
+    return ParallelReduce(
+        0, data.size(), 0.0, [&](size_t i) { return data[i]; },
+        std::plus<>{}, 1, ReduceMode::DETERMINISTIC);
+  };
+  auto first = reduce();
+  for (int i = 0; i != 10; ++i) {
+    EXPECT_EQ(first, reduce());
+  }
+}
+
+TEST(ParallelFor, ReduceDeterministicOrder) {
+  // concatenation is associative but not commutative, the blocks are
+  // combined in index order
+  constexpr size_t Size = 10000;
+  std::string expected;
+  for (size_t i = 0; i != Size; ++i) {
+    expected += static_cast<char>('a' + i % 26);
+  }
+  auto concat = ParallelReduce(
+      0, Size, std::string{},
+      [](size_t i) { return std::string(1, static_cast<char>('a' + i % 26)); },
+      std::plus<>{}, 100, ReduceMode::DETERMINISTIC);
+  EXPECT_EQ(expected, concat);
+}
+
 TEST(ParallelFor, MultipleCalls) {
   std::atomic<int> sum(0);
   ParallelFor(0, 100, [&](int i) { sum += i; });
@@ -120,6 +221,442 @@ TEST(ParallelFor, InitialDistribution) {
   });
   EXPECT_EQ(0, GetThreadIndex());
 }
+
+TEST(ParallelFor, InlineTasks) {
+  // partitioner tasks with small functors are stored in queue slots directly
+  int *data = nullptr;
+  auto func = [&data](size_t i) { data[i] = 0; };
+  using Traits = EigenPartitioner::detail::ParForTraits<EIGEN_MODE>;
+  static_assert(Eigen::TaskCell::IsInline<
+                EigenPartitioner::Task<Traits::SharingPolicy,
+                                       Traits::BalancingPolicy, decltype(func),
+                                       Traits::SplittingPolicy>>);
+}
+
+TEST(ParallelFor, ExternalCallerBlocks) {
+  // a thread outside of the pool shouldn't burn its cpu while waiting
+  auto threadCpuTime = []() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+  };
+  std::chrono::nanoseconds waited{};
+  std::thread([&]() {
+    auto start = threadCpuTime();
+    ParallelFor(0, GetNumThreads(), [&](int i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    });
+    waited = threadCpuTime() - start;
+  }).join();
+  EXPECT_LT(waited, std::chrono::milliseconds(100));
+}
+
+TEST(ParallelFor, SingleWorkerExternalCallers) {
+  // the only worker is the thread that created the arena, like the main
+  // thread of a default pool of one thread: it is busy joining the callers,
+  // so they have to run the tasks of their loops themselves
+  constexpr int Size = 1 << 20;
+  std::thread owner([]() {
+    EigenArena arena(1, {}, /* useMainThread */ true);
+    std::atomic<int64_t> sum(0);
+    auto run = [&]() {
+      EigenPartitioner::ParallelFor(arena, 0, Size, [&](size_t) { sum++; });
+    };
+    run();
+    std::vector<std::thread> callers;
+    for (int i = 0; i != 4; ++i) {
+      callers.emplace_back(run);
+    }
+    for (auto &caller : callers) {
+      caller.join();
+    }
+    EXPECT_EQ(5 * Size, sum);
+  });
+  owner.join();
+}
+
+TEST(ParallelFor, Arenas) {
+  EigenArena arena(3);
+  std::atomic<int> foreign(0);
+  EigenPartitioner::ParallelFor(arena, 0, 64, [&](size_t) {
+    foreign += arena.Pool().CurrentThreadId() == size_t(-1);
+  });
+  // the caller doesn't belong to the arena, so it doesn't run iterations
+  EXPECT_EQ(0, foreign);
+}
+
+TEST(ParallelFor, ArenasNested) {
+  // workers of both arenas wait for nested loops of each other
+  EigenArena first(2);
+  EigenArena second(3);
+  std::atomic<int> sum(0);
+  auto run = [&](EigenArena &arena, EigenArena &other) {
+    EigenPartitioner::ParallelFor(arena, 0, 64, [&](size_t) {
+      EigenPartitioner::ParallelFor(other, 0, 16, [&](size_t) { sum++; });
+    });
+  };
+  std::thread thread([&]() { run(first, second); });
+  run(second, first);
+  thread.join();
+  EXPECT_EQ(2 * 64 * 16, sum);
+}
+
+TEST(ParallelFor, ReduceArenas) {
+  // partials are indexed by the ids of the arena workers, also when the
+  // reduction is nested in a loop of the arena
+  constexpr size_t Size = 10000;
+  EigenArena arena(3);
+  auto sum = [&]() {
+    return ParallelReduce(
+        arena, 0, Size, size_t{0}, [&](size_t i) { return i; },
+        std::plus<>{});
+  };
+  EXPECT_EQ(Size * (Size - 1) / 2, sum());
+  std::atomic<size_t> nested(0);
+  EigenPartitioner::ParallelFor(arena, 0, 8, [&](size_t) { nested += sum(); });
+  EXPECT_EQ(8 * Size * (Size - 1) / 2, nested);
+  EXPECT_EQ(Size * (Size - 1) / 2,
+            ParallelReduce(
+                arena, 0, Size, size_t{0}, [&](size_t i) { return i; },
+                std::plus<>{}, 1, ReduceMode::DETERMINISTIC));
+}
+
+TEST(ParallelFor, Priority) {
+  // the only worker is busy while tasks are queued, then it runs high
+  // priority tasks first
+  EigenArena arena(1);
+  EigenPoolWrapper sched(arena);
+  std::atomic<bool> release(false);
+  std::atomic<int> done(0);
+  std::vector<int> order;
+  sched.run([&]() {
+    while (!release) {
+      CpuRelax();
+    }
+  });
+  for (int i = 0; i != 8; ++i) {
+    sched.run([&, i]() {
+      order.push_back(i);
+      done++;
+    }, i % 4 == 3 ? Eigen::Priority::HIGH : Eigen::Priority::NORMAL);
+  }
+  release = true;
+  while (done != 8) {
+    CpuRelax();
+  }
+  EXPECT_EQ((std::vector<int>{3, 7, 0, 1, 2, 4, 5, 6}), order);
+
+  std::atomic<int> sum(0);
+  EigenPartitioner::ParallelFor(0, 100, [&](int i) { sum += i; }, 1,
+                                Eigen::Priority::HIGH);
+  EXPECT_EQ(4950, sum);
+}
+
+TEST(ParallelFor, Cancellation) {
+  constexpr size_t Size = 1 << 20;
+  EigenPartitioner::CancellationToken token;
+  std::atomic<size_t> executed(0);
+  EigenPartitioner::ParallelFor(token, 0, Size, [&](size_t i) {
+    executed++;
+    token.Cancel();
+  });
+  // each task finishes at most its current chunk after the cancellation
+  EXPECT_LT(executed, Size / 2);
+}
+
+TEST(ParallelFor, FindFirst) {
+  constexpr size_t Size = 1 << 20;
+  for (size_t match : {size_t{0}, size_t{1}, size_t{777}, Size / 2, Size - 1}) {
+    EXPECT_EQ(match, EigenPartitioner::ParallelFindFirst(
+                         0, Size, [&](size_t i) { return i >= match; }));
+  }
+  EXPECT_EQ(Size, EigenPartitioner::ParallelFindFirst(
+                      10, Size, [](size_t i) { return false; }));
+  EXPECT_TRUE(EigenPartitioner::ParallelAnyOf(
+      0, Size, [](size_t i) { return i % 1000 == 999; }));
+  EXPECT_FALSE(EigenPartitioner::ParallelAnyOf(
+      0, Size, [](size_t i) { return i == Size; }));
+}
+
+TEST(ParallelFor, IterationCostCache) {
+  namespace EP = EigenPartitioner;
+  auto body = [](size_t) { CpuRelax(); };
+  auto &cost = EP::detail::IterationCost<decltype(body)>();
+  EXPECT_EQ(0, cost.load());
+  for (int i = 0; i != 3; ++i) {
+    std::atomic<int> count(0);
+    ParallelFor(0, 1 << 16, [&](size_t j) {
+      body(j);
+      count++;
+    });
+    ParallelFor(0, 1 << 16, body);
+    EXPECT_EQ(1 << 16, count);
+  }
+  if (EP::detail::ParForTraits<EIGEN_MODE>::BalancingPolicy ==
+      EP::Balancing::TIMESPAN) {
+    EXPECT_GT(cost.load(), 0);
+  }
+}
+
+TEST(ParallelFor, IterationCostSeedsGrainSize) {
+  // once the cost is known, a call splits its range right away into grains
+  // that fill the initial timespan instead of timing a whole timespan first;
+  // a single worker, so no task of the loop is shared
+  namespace EP = EigenPartitioner;
+  if (EP::detail::ParForTraits<EIGEN_MODE>::BalancingPolicy !=
+      EP::Balancing::TIMESPAN) {
+    GTEST_SKIP() << "grain sizes are seeded by TIMESPAN balancing only";
+  }
+  constexpr size_t Size = 1 << 20;
+  EigenArena arena(1);
+  size_t maxChunk = 0;
+  auto body = [&](size_t from, size_t to) {
+    maxChunk = std::max(maxChunk, to - from);
+    for (size_t i = from; i != to; ++i) {
+      CpuRelax();
+    }
+  };
+  EP::ParallelFor(arena, 0, Size, body);
+  auto &cost = EP::detail::IterationCost<decltype(body)>();
+  EXPECT_GT(cost.load(), 0);
+  // with a cost of an eighth of the timespan the seeded grain size is 8
+  // iterations, a timed warm-up would run many more of them in one task
+  cost = EP::detail::InitTime(arena) / 8.0;
+  maxChunk = 0;
+  EP::ParallelFor(arena, 0, Size, body);
+  EXPECT_LE(maxChunk, 8);
+}
+
+TEST(ParallelFor, HeartbeatPromotion) {
+  // the first iteration lasts a heartbeat, so the rest of the range of the
+  // worker is promoted and its second half is stolen by the other worker
+  namespace EP = EigenPartitioner;
+  constexpr size_t Size = 1024;
+  EigenArena arena(2);
+  std::atomic<bool> promotedRan(false);
+  std::atomic<int> timedOut(0);
+  EP::ParallelFor<EIGEN_HEARTBEAT>(
+      arena, 0, Size,
+      [&](size_t i) {
+        if (i == 0) {
+          auto start = Now();
+          while (Now() - start <= EP::detail::HeartbeatInterval(arena)) {
+            CpuRelax();
+          }
+        } else if (i < Size / 4) {
+          auto deadline =
+              std::chrono::steady_clock::now() + std::chrono::seconds(1);
+          while (!promotedRan && std::chrono::steady_clock::now() < deadline) {
+            CpuRelax();
+          }
+          timedOut += !promotedRan;
+        } else if (i < Size / 2) {
+          promotedRan = true;
+        }
+      },
+      1);
+  EXPECT_EQ(0, timedOut);
+}
+
+TEST(ParallelFor, HeartbeatStartsOnFirstUse) {
+  // a fresh thread has no heartbeat to catch up with
+  Timestamp before = Now();
+  Timestamp beat = 0;
+  std::thread([&]() { beat = EigenPartitioner::detail::LastHeartbeat(); })
+      .join();
+  EXPECT_LE(before, beat);
+  EXPECT_LE(beat, Now());
+}
+
+TEST(ParallelFor, TaskGroup) {
+  std::atomic<int> sum(0);
+  EigenPartitioner::TaskGroup group;
+  for (int i = 0; i != 100; ++i) {
+    group.run([&sum, i]() { sum += i; });
+  }
+  group.wait();
+  EXPECT_EQ(4950, sum);
+  // the group can be reused after wait
+  group.run([&sum]() { sum += 50; });
+  group.wait();
+  EXPECT_EQ(5000, sum);
+}
+
+TEST(ParallelFor, TaskGroupRecursive) {
+  // node of depth d has d + 1 children, groups are waited from nested tasks
+  // and from a thread outside of the pool
+  std::function<size_t(size_t)> count = [&](size_t depth) -> size_t {
+    if (depth == 5) {
+      return 1;
+    }
+    std::vector<size_t> children(depth + 1);
+    EigenPartitioner::TaskGroup group;
+    for (size_t i = 0; i != children.size(); ++i) {
+      group.run([&, i]() { children[i] = count(depth + 1); });
+    }
+    group.wait();
+    return 1 + std::accumulate(children.begin(), children.end(), size_t{0});
+  };
+  // 1 + 1 + 1 * 2 + 1 * 2 * 3 + 1 * 2 * 3 * 4 + 1 * 2 * 3 * 4 * 5
+  EXPECT_EQ(154, count(0));
+  size_t external = 0;
+  std::thread([&]() { external = count(0); }).join();
+  EXPECT_EQ(154, external);
+}
+
+TEST(ParallelFor, Spawn) {
+  std::function<int(int)> fib = [&](int n) {
+    if (n < 2) {
+      return n;
+    }
+    int x = 0;
+    int y = 0;
+    EigenPartitioner::Spawn([&]() { x = fib(n - 1); },
+                            [&]() { y = fib(n - 2); });
+    return x + y;
+  };
+  EXPECT_EQ(6765, fib(20));
+  // from a thread outside of the pool and from loop iterations
+  int external = 0;
+  std::thread([&]() { external = fib(15); }).join();
+  EXPECT_EQ(610, external);
+  std::atomic<int> sum(0);
+  ParallelFor(0, 8, [&](size_t) { sum += fib(10); });
+  EXPECT_EQ(8 * 55, sum);
+}
+
+TEST(ParallelFor, TaskGraph) {
+  // grid where every cell depends on the upper and the left ones, rows are
+  // hinted to threads
+  constexpr size_t Size = 16;
+  std::vector<size_t> paths(Size * Size);
+  EigenPartitioner::TaskGraph graph;
+  for (size_t i = 0; i != Size; ++i) {
+    for (size_t j = 0; j != Size; ++j) {
+      graph.AddNode(
+          [&, i, j]() {
+            paths[i * Size + j] =
+                i == 0 || j == 0
+                    ? 1
+                    : paths[(i - 1) * Size + j] + paths[i * Size + j - 1];
+          },
+          i % 2 == 0 ? i % GetNumThreads()
+                     : EigenPartitioner::TaskGraph::NoHint);
+      if (i != 0) {
+        graph.AddEdge((i - 1) * Size + j, i * Size + j);
+      }
+      if (j != 0) {
+        graph.AddEdge(i * Size + j - 1, i * Size + j);
+      }
+    }
+  }
+  ASSERT_EQ(Size * Size, graph.Size());
+  for (int run = 0; run != 10; ++run) {
+    std::fill(paths.begin(), paths.end(), 0);
+    graph.Run();
+    // C(30, 15) monotonic paths to the last cell
+    EXPECT_EQ(155117520, paths.back());
+  }
+  // from a thread outside of the pool
+  std::fill(paths.begin(), paths.end(), 0);
+  std::thread([&]() { graph.Run(); }).join();
+  EXPECT_EQ(155117520, paths.back());
+}
+
+static EigenAsync::Task<int> AsyncSquare(int x) {
+  co_await EigenPoolWrapper{}.schedule();
+  co_return x * x;
+}
+
+static EigenAsync::Task<int> AsyncSumOfSquares(int n) {
+  std::vector<EigenAsync::Task<int>> tasks;
+  for (int i = 0; i != n; ++i) {
+    tasks.push_back(AsyncSquare(i));
+  }
+  auto squares = co_await EigenAsync::when_all(std::move(tasks));
+  co_return std::accumulate(squares.begin(), squares.end(), 0);
+}
+
+static EigenAsync::Task<> AsyncCount(std::atomic<int> &count, int n) {
+  std::vector<EigenAsync::Task<>> tasks;
+  for (int i = 0; i != n; ++i) {
+    tasks.push_back([](std::atomic<int> &count) -> EigenAsync::Task<> {
+      count++;
+      co_return;
+    }(count));
+  }
+  co_await EigenAsync::when_all(std::move(tasks));
+}
+
+TEST(ParallelFor, Coroutines) {
+  EXPECT_EQ(25, EigenAsync::sync_wait(AsyncSquare(5)));
+  EXPECT_EQ(328350, EigenAsync::sync_wait(AsyncSumOfSquares(100)));
+  EXPECT_EQ(0, EigenAsync::sync_wait(AsyncSumOfSquares(0)));
+  // from loop iterations and from a thread outside of the pool
+  std::atomic<int> count(0);
+  ParallelFor(0, 8, [&](size_t) {
+    EigenAsync::sync_wait(AsyncCount(count, 16));
+  });
+  EXPECT_EQ(8 * 16, count);
+  int external = 0;
+  std::thread([&]() {
+    external = EigenAsync::sync_wait(AsyncSumOfSquares(10));
+  }).join();
+  EXPECT_EQ(285, external);
+}
+
+TEST(ParallelFor, QueueOverflow) {
+  // push much more tasks than local queue can hold, none of them should be
+  // executed inline by the pushing thread
+  constexpr int Tasks = 16 * 1024;
+  std::atomic<int> done(0);
+  std::atomic<bool> pushing(true);
+  std::atomic<int> inlined(0);
+  const auto pusher = std::this_thread::get_id();
+  for (int i = 0; i != Tasks; ++i) {
+    EigenPoolWrapper{}.run([&]() {
+      if (pushing && std::this_thread::get_id() == pusher) {
+        inlined++;
+      }
+      done++;
+    });
+  }
+  pushing = false;
+  while (done != Tasks) {
+    EigenPoolWrapper{}.execute_something_else();
+  }
+  EXPECT_EQ(0, inlined);
+}
+
+TEST(ParallelFor, QueueOverflowOrder) {
+  // the owner must run its newest task first even when it was spilled past
+  // the local queue
+  constexpr int Tasks = 1024 + 64;
+  std::atomic<int> done(0);
+  std::atomic<int> first(-1);
+  const auto pusher = std::this_thread::get_id();
+  for (int i = 0; i != Tasks; ++i) {
+    EigenPoolWrapper{}.run([&, i]() {
+      if (std::this_thread::get_id() == pusher) {
+        int expected = -1;
+        first.compare_exchange_strong(expected, i);
+      }
+      auto start = Now();
+      while (Now() - start < 10000) {
+        CpuRelax();
+      }
+      done++;
+    });
+  }
+  while (done != Tasks) {
+    EigenPoolWrapper{}.execute_something_else();
+  }
+  // thieves take the oldest tasks, so the newest one is left to the owner
+  // unless they drained everything before it got to run
+  if (first != -1) {
+    EXPECT_EQ(Tasks - 1, first);
+  }
+}
 #endif
 
 #if EIGEN_MODE == EIGEN_TIMESPAN || EIGEN_MODE == EIGEN_TIMESPAN_GRAINSIZE
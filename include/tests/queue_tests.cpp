@@ -0,0 +1,178 @@
+#include "../eigen/chase_lev_deque.h"
+#include "../eigen/run_queue.h"
+#include "../eigen/task_cell.h"
+#include <atomic>
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+template <typename Queue> class QueueTest : public ::testing::Test {};
+
+using QueueTypes = ::testing::Types<Eigen::RunQueue<size_t *, 64>,
+                                    Eigen::ChaseLevDeque<size_t *, 64>>;
+TYPED_TEST_SUITE(QueueTest, QueueTypes);
+
+TYPED_TEST(QueueTest, Basic) {
+  TypeParam queue;
+  std::vector<size_t> items(3);
+  EXPECT_TRUE(queue.Empty());
+  EXPECT_EQ(nullptr, queue.PopFront());
+  EXPECT_EQ(nullptr, queue.PopBack());
+  for (auto &item : items) {
+    EXPECT_TRUE(queue.PushFront(&item));
+  }
+  EXPECT_EQ(3, queue.Size());
+  EXPECT_EQ(&items[2], queue.PopFront());
+  EXPECT_EQ(&items[0], queue.PopBack());
+  EXPECT_EQ(&items[1], queue.PopFront());
+  EXPECT_TRUE(queue.Empty());
+}
+
+TYPED_TEST(QueueTest, Full) {
+  TypeParam queue;
+  std::vector<size_t> items(65);
+  for (size_t i = 0; i != 64; ++i) {
+    EXPECT_TRUE(queue.PushFront(&items[i]));
+  }
+  EXPECT_FALSE(queue.PushFront(&items[64]));
+  EXPECT_EQ(64, queue.Size());
+  queue.Flush();
+  EXPECT_TRUE(queue.Empty());
+}
+
+TYPED_TEST(QueueTest, PopBackHalf) {
+  TypeParam queue;
+  std::vector<size_t> items(10);
+  for (auto &item : items) {
+    queue.PushFront(&item);
+  }
+  std::vector<size_t *> stolen;
+  EXPECT_EQ(5, queue.PopBackHalf(&stolen));
+  EXPECT_EQ(5, stolen.size());
+  // from the newest to the oldest
+  EXPECT_EQ(&items[4], stolen.front());
+  EXPECT_EQ(&items[0], stolen.back());
+  EXPECT_EQ(5, queue.Size());
+  queue.Flush();
+}
+
+TYPED_TEST(QueueTest, ConcurrentSteal) {
+  // every pushed item must be taken exactly once, either by the owner or by
+  // one of the thieves
+  constexpr size_t Items = 1 << 16;
+  constexpr size_t Thieves = 4;
+  TypeParam queue;
+  std::vector<size_t> taken(Items);
+  std::atomic<bool> done{false};
+  std::vector<std::thread> thieves;
+  for (size_t t = 0; t != Thieves; ++t) {
+    thieves.emplace_back([&]() {
+      while (!done.load()) {
+        if (auto item = queue.PopBack()) {
+          ++*item;
+        }
+      }
+    });
+  }
+  for (size_t i = 0; i != Items;) {
+    if (queue.PushFront(&taken[i])) {
+      ++i;
+    }
+    if (i % 3 == 0) {
+      if (auto item = queue.PopFront()) {
+        ++*item;
+      }
+    }
+  }
+  while (!queue.Empty()) {
+    if (auto item = queue.PopFront()) {
+      ++*item;
+    }
+  }
+  done = true;
+  for (auto &t : thieves) {
+    t.join();
+  }
+  for (size_t i = 0; i != Items; ++i) {
+    EXPECT_EQ(1, taken[i]) << "item " << i;
+  }
+}
+
+TEST(TaskCell, Inline) {
+  int runs = 0;
+  auto f = [&runs]() { ++runs; };
+  static_assert(Eigen::TaskCell::IsInline<decltype(f)>);
+  Eigen::TaskCell cell{f};
+  EXPECT_TRUE(cell);
+  auto copy = cell; // queues move cells with plain copies
+  copy();
+  EXPECT_FALSE(copy);
+  EXPECT_EQ(1, runs);
+}
+
+TEST(TaskCell, Boxed) {
+  auto counter = std::make_shared<int>(0);
+  auto f = [counter]() { ++*counter; };
+  static_assert(!Eigen::TaskCell::IsInline<decltype(f)>);
+  Eigen::TaskCell cell{std::move(f)};
+  EXPECT_EQ(2, counter.use_count());
+  cell();
+  EXPECT_EQ(1, *counter);
+  EXPECT_EQ(1, counter.use_count());
+
+  Eigen::TaskCell dropped{[counter]() { ++*counter; }};
+  EXPECT_EQ(2, counter.use_count());
+  dropped.Reset();
+  EXPECT_FALSE(dropped);
+  EXPECT_EQ(1, *counter);
+  EXPECT_EQ(1, counter.use_count());
+}
+
+template <typename Queue> class CellQueueTest : public ::testing::Test {};
+
+using CellQueueTypes =
+    ::testing::Types<Eigen::RunQueue<Eigen::TaskCell, 64>,
+                     Eigen::ChaseLevDeque<Eigen::TaskCell, 64>>;
+TYPED_TEST_SUITE(CellQueueTest, CellQueueTypes);
+
+TYPED_TEST(CellQueueTest, ConcurrentSteal) {
+  // every pushed cell must be run exactly once
+  constexpr size_t Items = 1 << 14;
+  constexpr size_t Thieves = 4;
+  TypeParam queue;
+  std::vector<std::atomic<size_t>> runs(Items);
+  std::atomic<bool> done{false};
+  std::vector<std::thread> thieves;
+  for (size_t t = 0; t != Thieves; ++t) {
+    thieves.emplace_back([&]() {
+      while (!done.load()) {
+        if (auto cell = queue.PopBack()) {
+          cell();
+        }
+      }
+    });
+  }
+  for (size_t i = 0; i != Items;) {
+    if (queue.PushFront(Eigen::TaskCell{[&runs, i]() { ++runs[i]; }})) {
+      ++i;
+    }
+    if (i % 3 == 0) {
+      if (auto cell = queue.PopFront()) {
+        cell();
+      }
+    }
+  }
+  while (!queue.Empty()) {
+    if (auto cell = queue.PopFront()) {
+      cell();
+    }
+  }
+  done = true;
+  for (auto &t : thieves) {
+    t.join();
+  }
+  for (size_t i = 0; i != Items; ++i) {
+    EXPECT_EQ(1, runs[i]) << "item " << i;
+  }
+}
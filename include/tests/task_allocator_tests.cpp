@@ -0,0 +1,86 @@
+#include "../eigen/task_allocator.h"
+#include <atomic>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <set>
+#include <thread>
+#include <vector>
+
+using Eigen::TaskAllocator;
+
+TEST(TaskAllocator, Basic) {
+  std::vector<void *> blocks;
+  for (size_t size : {1, 8, 48, 49, 100, 200, 496, 497, 4096}) {
+    auto p = TaskAllocator::Allocate(size);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(p) % alignof(std::max_align_t));
+    std::memset(p, 0xff, size);
+    blocks.push_back(p);
+  }
+  EXPECT_EQ(blocks.size(), std::set<void *>(blocks.begin(), blocks.end()).size());
+  for (auto p : blocks) {
+    TaskAllocator::Deallocate(p);
+  }
+}
+
+TEST(TaskAllocator, Reuse) {
+  // freed block is reused by the owner
+  auto p = TaskAllocator::Allocate(32);
+  TaskAllocator::Deallocate(p);
+  EXPECT_EQ(p, TaskAllocator::Allocate(32));
+  TaskAllocator::Deallocate(p);
+}
+
+TEST(TaskAllocator, RemoteFree) {
+  // blocks freed by other thread come back to the owner after flush
+  constexpr size_t Blocks = 1000;
+  std::vector<void *> blocks;
+  for (size_t i = 0; i != Blocks; ++i) {
+    blocks.push_back(TaskAllocator::Allocate(64));
+  }
+  std::thread([&]() {
+    for (auto p : blocks) {
+      TaskAllocator::Deallocate(p);
+    }
+    TaskAllocator::Flush();
+  }).join();
+  std::set<void *> freed(blocks.begin(), blocks.end());
+  size_t reused = 0;
+  std::vector<void *> again;
+  for (size_t i = 0; i != 2 * Blocks; ++i) {
+    again.push_back(TaskAllocator::Allocate(64));
+    reused += freed.count(again.back());
+  }
+  EXPECT_EQ(Blocks, reused);
+  for (auto p : again) {
+    TaskAllocator::Deallocate(p);
+  }
+}
+
+TEST(TaskAllocator, ConcurrentRemoteFree) {
+  // each thread allocates blocks and frees blocks of its neighbour
+  constexpr size_t Threads = 4;
+  constexpr size_t Iterations = 1 << 16;
+  std::vector<std::atomic<void *>> slots(Threads);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t != Threads; ++t) {
+    threads.emplace_back([&, t]() {
+      for (size_t i = 0; i != Iterations; ++i) {
+        auto p = static_cast<size_t *>(TaskAllocator::Allocate(sizeof(size_t)));
+        *p = t;
+        if (auto old = slots[(t + 1) % Threads].exchange(p)) {
+          EXPECT_EQ(t, *static_cast<size_t *>(old));
+          TaskAllocator::Deallocate(old);
+        }
+        if (auto own = slots[t].exchange(nullptr)) {
+          TaskAllocator::Deallocate(own);
+        }
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  for (auto &slot : slots) {
+    TaskAllocator::Deallocate(slot.load());
+  }
+}
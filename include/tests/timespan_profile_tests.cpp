@@ -0,0 +1,79 @@
+#include "../timespan_partitioner.h"
+#include "../timespan_profile.h"
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+
+namespace {
+
+struct TempProfile {
+  TempProfile()
+      : Path(std::filesystem::temp_directory_path() /
+             ("timespan_profile_test_" + std::to_string(getpid()))) {}
+  ~TempProfile() { std::filesystem::remove(Path); }
+
+  std::filesystem::path Path;
+};
+
+} // namespace
+
+TEST(TimespanProfile, Missing) {
+  TempProfile profile;
+  EXPECT_FALSE(LoadTimespanProfile(profile.Path, "host/cpu", 4));
+}
+
+TEST(TimespanProfile, SaveLoad) {
+  TempProfile profile;
+  EXPECT_TRUE(SaveTimespanProfile(profile.Path, "host/cpu", 4, 1000));
+  EXPECT_TRUE(SaveTimespanProfile(profile.Path, "host/cpu", 8, 2000));
+  EXPECT_TRUE(SaveTimespanProfile(profile.Path, "other/cpu", 4, 3000));
+  EXPECT_EQ(1000, LoadTimespanProfile(profile.Path, "host/cpu", 4));
+  EXPECT_EQ(2000, LoadTimespanProfile(profile.Path, "host/cpu", 8));
+  EXPECT_EQ(3000, LoadTimespanProfile(profile.Path, "other/cpu", 4));
+  EXPECT_FALSE(LoadTimespanProfile(profile.Path, "host/cpu", 16));
+
+  // entry is replaced, others are kept
+  EXPECT_TRUE(SaveTimespanProfile(profile.Path, "host/cpu", 4, 1500));
+  EXPECT_EQ(1500, LoadTimespanProfile(profile.Path, "host/cpu", 4));
+  EXPECT_EQ(3000, LoadTimespanProfile(profile.Path, "other/cpu", 4));
+}
+
+TEST(TimespanProfile, MalformedLines) {
+  TempProfile profile;
+  {
+    std::ofstream out(profile.Path);
+    out << "garbage\n"
+        << "host/cpu\tx\t1\n"
+        << "host/cpu\t4\t1000\n";
+  }
+  EXPECT_EQ(1000, LoadTimespanProfile(profile.Path, "host/cpu", 4));
+}
+
+TEST(TimespanProfile, MachineName) {
+  auto name = MachineName();
+  EXPECT_NE(std::string::npos, name.find('/'));
+  EXPECT_EQ(std::string::npos, name.find('\t'));
+}
+
+TEST(TimespanProfile, CalibrationWithoutWorkers) {
+  // the only worker is skipped, nothing to measure
+  EigenArena arena(1);
+  EXPECT_EQ(DefaultTimespan(),
+            EigenPartitioner::detail::CalibrateTimespan(arena.Pool()));
+  EXPECT_GT(DefaultTimespan(), 0);
+}
+
+TEST(TimespanProfile, PerArena) {
+  // every arena looks up the entry for its own number of threads, once
+  TempProfile profile;
+  ASSERT_TRUE(SaveTimespanProfile(profile.Path, MachineName(), 2, 1000));
+  ASSERT_TRUE(SaveTimespanProfile(profile.Path, MachineName(), 3, 2000));
+  setenv("BENCH_TIMESPAN_PROFILE", profile.Path.c_str(), 1);
+  EigenArena two(2);
+  EigenArena three(3);
+  EXPECT_EQ(1000, EigenPartitioner::detail::InitTime(two));
+  EXPECT_EQ(2000, EigenPartitioner::detail::InitTime(three));
+  ASSERT_TRUE(SaveTimespanProfile(profile.Path, MachineName(), 2, 1500));
+  EXPECT_EQ(1000, EigenPartitioner::detail::InitTime(two));
+  unsetenv("BENCH_TIMESPAN_PROFILE");
+}
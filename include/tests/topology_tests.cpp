@@ -0,0 +1,121 @@
+#include "../topology.h"
+#include <gtest/gtest.h>
+#include <set>
+
+TEST(Topology, ParseCpuList) {
+  EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 8, 10, 11}),
+            detail::ParseCpuList("0-3,8,10-11"));
+  EXPECT_EQ(std::vector<int>({5}), detail::ParseCpuList("5"));
+  EXPECT_TRUE(detail::ParseCpuList("").empty());
+}
+
+TEST(Topology, AllowedCpus) {
+  const auto &cpus = Topology::Get().Cpus;
+  EXPECT_EQ(detail::AllowedCpus().size(), cpus.size());
+  std::set<int> ids;
+  for (auto &cpu : cpus) {
+    ids.insert(cpu.Id);
+  }
+  EXPECT_EQ(cpus.size(), ids.size());
+}
+
+TEST(Topology, StealDomains) {
+  // domains are nested, contain the worker and are neither trivial nor global
+  auto numThreads = Topology::Get().Cpus.size();
+  auto domains = GetStealDomains(numThreads);
+  ASSERT_EQ(numThreads, domains.size());
+  for (size_t worker = 0; worker != numThreads; ++worker) {
+    std::pair<unsigned, unsigned> prev(worker, worker + 1);
+    for (auto &range : domains[worker]) {
+      EXPECT_LE(range.first, prev.first);
+      EXPECT_GE(range.second, prev.second);
+      EXPECT_NE(prev, range);
+      EXPECT_LT(range.second - range.first, numThreads);
+      prev = range;
+    }
+  }
+  EXPECT_TRUE(GetStealDomains(numThreads + 1)[0].empty());
+}
+
+TEST(Topology, StealDomainsDualSocket) {
+  // 2 nodes x 2 LLCs x 2 cores with 2 SMT threads each
+  std::vector<CpuInfo> cpus;
+  for (int id = 0; id != 16; ++id) {
+    cpus.push_back(CpuInfo{.Id = id, .Package = id / 8, .Node = id / 8,
+                           .L2 = id / 2 * 2, .Llc = id / 4 * 4});
+  }
+  auto domains = GetStealDomains(cpus, 16);
+  using Ranges = std::vector<std::pair<unsigned, unsigned>>;
+  EXPECT_EQ(Ranges({{0, 2}, {0, 4}, {0, 8}}), domains[0]);
+  EXPECT_EQ(Ranges({{10, 12}, {8, 12}, {8, 16}}), domains[11]);
+  // only first node is used: node domain is global
+  domains = GetStealDomains(cpus, 8);
+  EXPECT_EQ(Ranges({{6, 8}, {4, 8}}), domains[7]);
+}
+
+TEST(Topology, SmtSiblingsGoLast) {
+  // 2 LLCs x 2 cores x 2 SMT threads, ordered as Topology::Get does
+  std::vector<CpuInfo> cpus;
+  for (int llc = 0; llc != 2; ++llc) {
+    for (int rank = 0; rank != 2; ++rank) {
+      for (int core = 0; core != 2; ++core) {
+        int id = llc * 2 + core + rank * 4;
+        cpus.push_back(CpuInfo{.Id = id, .Core = llc * 2 + core,
+                               .SmtRank = rank, .L2 = llc * 2 + core,
+                               .Llc = llc * 2});
+      }
+    }
+  }
+  auto domains = GetStealDomains(cpus, 8);
+  using Ranges = std::vector<std::pair<unsigned, unsigned>>;
+  EXPECT_EQ(Ranges({{0, 4}}), domains[0]);
+  EXPECT_EQ(Ranges({{4, 8}}), domains[7]);
+  Topology topology{.Cpus = cpus};
+  EXPECT_EQ(4, topology.NumCores());
+  EXPECT_EQ(1, topology.NumPackages());
+}
+
+TEST(Topology, StealDomainsSmtL2) {
+  // 2 LLCs x 2 L2 clusters x 2 cores x 2 SMT threads, sibling ids are 8 apart
+  auto makeCpus = [](int coresPerL2) {
+    std::vector<CpuInfo> cpus;
+    for (int id = 0; id != 16; ++id) {
+      int core = id % 8;
+      cpus.push_back(CpuInfo{.Id = id, .Core = core, .SmtRank = id / 8,
+                             .L2 = core / coresPerL2 * coresPerL2,
+                             .Llc = core / 4 * 4});
+    }
+    detail::SortCpus(cpus);
+    return cpus;
+  };
+  using Ranges = std::vector<std::pair<unsigned, unsigned>>;
+  // cores of an L2 cluster are neighbours in both SMT ranks
+  auto cpus = makeCpus(2);
+  EXPECT_EQ(0, cpus[0].Id);
+  EXPECT_EQ(8, cpus[4].Id);
+  auto domains = GetStealDomains(cpus, 16);
+  EXPECT_EQ(Ranges({{0, 2}, {0, 8}}), domains[0]);
+  EXPECT_EQ(Ranges({{6, 8}, {0, 8}}), domains[7]);
+  EXPECT_EQ(Ranges({{10, 12}, {8, 16}}), domains[11]);
+  // private L2 per core: siblings are 4 workers apart, no L2 level
+  cpus = makeCpus(1);
+  domains = GetStealDomains(cpus, 16);
+  EXPECT_EQ(cpus[0].L2, cpus[4].L2);
+  EXPECT_EQ(Ranges({{0, 8}}), domains[0]);
+  EXPECT_EQ(Ranges({{8, 16}}), domains[12]);
+}
+
+TEST(Topology, DefaultNumThreads) {
+  // 2 nodes x 4 cores x 2 SMT threads
+  Topology topology;
+  for (int id = 0; id != 16; ++id) {
+    topology.Cpus.push_back(
+        CpuInfo{.Id = id, .Node = id / 8, .Core = id % 4, .SmtRank = id / 4 % 2});
+  }
+  EXPECT_EQ(2, topology.NumNodes());
+  EXPECT_EQ(4, topology.DefaultNumThreads());
+  topology.CpuQuota = 2.5;
+  EXPECT_EQ(3, topology.DefaultNumThreads());
+  topology.CpuQuota = 0.5;
+  EXPECT_EQ(1, topology.DefaultNumThreads());
+}
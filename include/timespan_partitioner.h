@@ -7,13 +7,22 @@
 #include "modes.h"
 #include "num_threads.h"
 #include "thread_index.h"
+#include "timespan_profile.h"
 #include "util.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 namespace EigenPartitioner {
 
@@ -26,9 +35,14 @@ struct Range {
 
 struct SplitData {
   static constexpr size_t K_SPLIT = 2;
+  // lazy splitting stops at this depth of balancing tasks
+  static constexpr size_t K_MAX_DEPTH = 16;
   Range Threads;
   size_t GrainSize = 1;
+  // number of balancing splits this task is away from a shared one
   size_t Depth = 0;
+  // priority of the tasks of the loop
+  Eigen::Priority Priority = Eigen::Priority::NORMAL;
 };
 
 namespace detail {
@@ -58,12 +72,146 @@ inline TaskStack& ThreadLocalTaskStack() {
   static thread_local TaskStack stack;
   return stack;
 }
+
+// Measures the initial timespan like timespan_tuner does: the 0.99
+// percentile of the time it takes for a task shared with every worker to
+// start on the slowest one. Worker 0 and the calling thread are skipped, they
+// might not be looking for tasks. A round waits for at most a millisecond, so
+// busy workers can't block the calibration. Without other workers there is
+// nothing to measure, and DefaultTimespan is returned: a zero timespan would
+// split TIMESPAN tasks at the first check and make heartbeats fire always.
+inline uint64_t CalibrateTimespan(Eigen::ThreadPool &pool) {
+  constexpr size_t Rounds = 200;
+  struct Round {
+    std::atomic<Timestamp> Max{0};
+    std::atomic<size_t> Reported{0};
+  };
+  // late tasks of timed out rounds may outlive the calibration
+  auto rounds = std::make_shared<std::vector<Round>>(Rounds);
+  std::vector<Timestamp> maximums;
+  for (size_t r = 0; r != Rounds; ++r) {
+    auto &round = (*rounds)[r];
+    size_t expected = 0;
+    auto start = Now();
+    for (size_t i = 1; i < pool.NumThreads(); ++i) {
+      if (i == pool.CurrentThreadId()) {
+        continue;
+      }
+      pool.RunOnThread(Eigen::TaskCell{[rounds, r, start]() {
+                         auto &round = (*rounds)[r];
+                         auto elapsed = Now() - start;
+                         auto max = round.Max.load(std::memory_order_relaxed);
+                         while (max < elapsed &&
+                                !round.Max.compare_exchange_weak(max, elapsed)) {
+                         }
+                         round.Reported.fetch_add(1, std::memory_order_release);
+                       }},
+                       i);
+      ++expected;
+    }
+    if (expected == 0) {
+      return DefaultTimespan();
+    }
+    auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+    while (round.Reported.load(std::memory_order_acquire) != expected &&
+           std::chrono::steady_clock::now() < deadline) {
+      CpuRelax();
+    }
+    maximums.push_back(round.Reported.load(std::memory_order_acquire) ==
+                               expected
+                           ? round.Max.load(std::memory_order_relaxed)
+                           : Now() - start);
+  }
+  std::sort(maximums.begin(), maximums.end());
+  return std::max(maximums[maximums.size() * 99 / 100], uint64_t{1});
+}
+
+// Cost of an iteration (in Now() ticks) of loops with body Func, learned by
+// TIMESPAN balancing and used to seed the grain size of later calls, 0 if
+// unknown. Lambdas have distinct types, so in practice it is kept per call
+// site.
+template <typename Func>
+std::atomic<double> &IterationCost() {
+  static std::atomic<double> cost{0};
+  return cost;
+}
+
+// Initial timespan of TIMESPAN balancing on the arena: from the timespan
+// profile if it has an entry for this machine and the number of threads of
+// the arena (see timespan_tuner), otherwise from a calibration run on the
+// arena itself. It is kept in the arena, so loops of an arena neither build
+// the default pool nor use a timespan measured for another thread count.
+inline uint64_t InitTime(EigenArena &arena) {
+  return arena.Timespan([&arena]() {
+    if (auto cycles = LoadTimespanProfile(TimespanProfilePath(), MachineName(),
+                                          arena.NumThreads())) {
+      return *cycles;
+    }
+    return CalibrateTimespan(arena.Pool());
+  });
+}
+
+// Heartbeat of HEARTBEAT splitting on the arena in Now() ticks: BENCH_HEARTBEAT
+// if set, otherwise a few initial timespans. A promotion costs about the time
+// a task needs to reach another worker, so its overhead stays a fixed fraction
+// of the work done between heartbeats.
+inline uint64_t HeartbeatInterval(EigenArena &arena) {
+  constexpr uint64_t TimespansPerHeartbeat = 4;
+  static const auto fixed = []() -> std::optional<uint64_t> {
+    if (const char *envHeartbeat = std::getenv("BENCH_HEARTBEAT")) {
+      return std::stoull(envHeartbeat);
+    }
+    return std::nullopt;
+  }();
+  if (fixed) {
+    return *fixed;
+  }
+  return std::max(InitTime(arena), uint64_t{1}) * TimespansPerHeartbeat;
+}
+
+// Time of the last heartbeat of the calling worker, kept across tasks. It
+// starts at the first use on the thread, so that a worker's first poll
+// doesn't promote before a heartbeat has elapsed.
+inline Timestamp &LastHeartbeat() {
+  static thread_local Timestamp beat = Now();
+  return beat;
+}
 }
 
-struct TaskNode : intrusive_ref_counter<TaskNode> {
+// Cooperative cancellation of a loop: it is checked between chunks and
+// before split tasks start, so chunks that haven't started yet are skipped
+// once they are cancelled, running ones are finished.
+class CancellationToken {
+public:
+  // Cancels all remaining iterations.
+  void Cancel() { CancelFrom(0); }
+
+  // Cancels remaining iterations with index >= from.
+  void CancelFrom(size_t from) {
+    auto limit = Limit_.load(std::memory_order_relaxed);
+    while (from < limit && !Limit_.compare_exchange_weak(
+                               limit, from, std::memory_order_relaxed)) {
+    }
+  }
+
+  bool IsCancelled(size_t index) const {
+    return index >= Limit_.load(std::memory_order_relaxed);
+  }
+
+  // Smallest cancelled index, SIZE_MAX if nothing is cancelled.
+  size_t Limit() const { return Limit_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<size_t> Limit_{SIZE_MAX};
+};
+
+struct TaskNode : intrusive_ref_counter<TaskNode>, Eigen::TaskAllocated {
   using NodePtr = IntrusivePtr<TaskNode>;
 
-  TaskNode(NodePtr parent = NodePtr{nullptr}) : Parent(std::move(parent)) {}
+  // children share the cancellation token of the root
+  TaskNode(NodePtr parent = NodePtr{nullptr})
+      : Parent(std::move(parent)), Token(Parent ? Parent->Token : nullptr) {}
 
   void SpawnChild(size_t count = 1) {
     ChildWaitingSteal_.fetch_add(count, std::memory_order_relaxed);
@@ -78,6 +226,7 @@ struct TaskNode : intrusive_ref_counter<TaskNode> {
   }
 
   NodePtr Parent;
+  const CancellationToken *Token;
 
   std::atomic<size_t> ChildWaitingSteal_{0};
 };
@@ -88,38 +237,42 @@ enum class Sharing { ENABLED, DISABLED };
 
 enum class Balancing { STATIC, TIMESPAN };
 
-template <Sharing SharingPolicy, Balancing BalancingPolicy, typename F>
+// EAGER halves the range into balancing tasks until it is not divisible.
+// LAZY splits off one half and splits again only once it has been stolen (or
+// the depth limit is reached), so a loop nobody steals from creates a few
+// tasks instead of one per grain.
+// HEARTBEAT splits off half of the remaining range only when the heartbeat of
+// the worker has elapsed, whatever the cost of an iteration is.
+enum class Splitting { EAGER, LAZY, HEARTBEAT };
+
+// Loop bodies are called either with an index, func(i), or with a chunk of
+// contiguous indices, func(begin, end) (see ParallelForRange).
+template <typename Func>
+inline constexpr bool IsRangeBody =
+    std::is_invocable_v<Func &, size_t, size_t>;
+
+template <Sharing SharingPolicy, Balancing BalancingPolicy, typename F,
+          Splitting SplittingPolicy = Splitting::EAGER>
 struct Task {
   using Scheduler = EigenPoolWrapper;
   using Func = std::decay_t<F>;
 
-  static inline const uint64_t INIT_TIME = [] {
-  // should be calculated using timespan_tuner with EIGEN_SIMPLE
-  // currently 0.99 percentile for maximums is used: 99% of iterations should
-  // fit scheduling in timespan
-#if defined(__x86_64__)
-    if (GetNumThreads() == 48) {
-      return 16500;
-    }
-    // return 13500;
-    return 205000;
-#elif defined(__aarch64__)
-    return 1800;
-#else
-#error "Unsupported architecture"
-#endif
-  }();
-
   using StolenFlag = std::atomic<bool>;
 
   Task(Scheduler &sched, TaskNode::NodePtr node, size_t from, size_t to,
        Func func, SplitData split)
       : Sched_(sched), CurrentNode_(std::move(node)), Current_(from), End_(to),
-        Func_(std::move(func)), Split_(split) {
+        Func_(std::move(func)), Split_(split), Token_(CurrentNode_->Token) {
   }
 
   bool IsDivisible() const {
-    return (Current_ + Split_.GrainSize < End_) && !is_stack_half_full();
+    return (Current_ + Split_.GrainSize < End_) && !is_stack_half_full() &&
+           !IsCancelled();
+  }
+
+  // Checked between chunks and before splitting, never per iteration.
+  bool IsCancelled() const {
+    return Token_ && Token_->IsCancelled(Current_);
   }
 
   void DistributeWork() {
@@ -157,12 +310,13 @@ struct Task {
           IntrusivePtr newNodePtr{new TaskNode{CurrentNode_}};
 
           Sched_.run_on_thread(
-              Task<SharingPolicy, BalancingPolicy, Func>{
+              Task<SharingPolicy, BalancingPolicy, Func, SplittingPolicy>{
                   Sched_, std::move(newNodePtr), otherData.From, dataSplit,
                   Func_,
                   SplitData{.Threads = {otherThreads.From, threadSplit},
-                            .GrainSize = Split_.GrainSize}},
-              otherThreads.From);
+                            .GrainSize = Split_.GrainSize,
+                            .Priority = Split_.Priority}},
+              otherThreads.From, Split_.Priority);
           otherThreads.From = threadSplit;
           otherData.From = dataSplit;
         }
@@ -179,52 +333,151 @@ struct Task {
     detail::TaskStack ts;
     auto& stack = detail::ThreadLocalTaskStack();
     stack.Add(ts);
+    if constexpr (SplittingPolicy == Splitting::LAZY) {
+      if (Split_.Depth != 0) {
+        // balancing task of a lazy split: the spawner may split again
+        CurrentNode_->OnStolen();
+      }
+    }
     if constexpr (SharingPolicy == Sharing::ENABLED) {
       DistributeWork();
     }
 
     if constexpr (BalancingPolicy == Balancing::TIMESPAN) {
-      // at first we are executing job for INIT_TIME
+      // at first we are executing job for the initial timespan
       // and then create balancing task
-      Split_.GrainSize = 1;
-      auto start = Now();
-      while (Current_ < End_) {
-        Execute();
-        if (Now() - start > INIT_TIME) {
-          break;
-        }
-        Split_.GrainSize++;
-      }
+      ExecuteTimespan();
     }
 
-    while (Current_ != End_ && IsDivisible()) {
-      // make balancing tasks for remaining iterations
-      // TODO: check stolen? maybe not each time?
-      // if (CurrentNode_->AllStolen()) {
-      // TODO: maybe we need to check "depth" - number of being stolen
-      // times?
-      size_t mid = Current_ + (End_ - Current_) / 2;
-      // CurrentNode_->SpawnChild();
-      // eigen's scheduler will push task to the current thread queue,
-      // then some other thread can steal this
-      IntrusivePtr<TaskNode> nodePtr{new TaskNode{CurrentNode_}};
-      Sched_.run(Task<Sharing::DISABLED, Balancing::STATIC, Func>{ // already shared and counted grainsize
-          Sched_, std::move(nodePtr), mid, End_, Func_,
-          SplitData{.GrainSize = Split_.GrainSize, .Depth = Split_.Depth + 1}});
-      End_ = mid;
+    if constexpr (SplittingPolicy == Splitting::LAZY) {
+      while (Current_ != End_ && !IsCancelled()) {
+        if (Split_.Depth < SplitData::K_MAX_DEPTH &&
+            CurrentNode_->AllStolen() && IsDivisible()) {
+          CurrentNode_->SpawnChild();
+          SplitHalf();
+        }
+        ExecuteRange(std::min(End_, Current_ + Split_.GrainSize));
+      }
+    } else if constexpr (SplittingPolicy == Splitting::HEARTBEAT) {
+      ExecuteHeartbeat();
+    } else {
+      while (Current_ != End_ && IsDivisible()) {
+        // make balancing tasks for remaining iterations
+        SplitHalf();
+      }
     }
 
-    while (Current_ != End_) {
-      Execute();
+    if (!IsCancelled()) {
+      ExecuteRange(End_);
     }
     CurrentNode_.Reset();
     stack.Pop();
   }
 
 private:
-  void Execute() {
-    Func_(Current_);
-    ++Current_;
+  // Executes iterations up to end as one chunk, callers check cancellation
+  // before it.
+  void ExecuteRange(size_t end) {
+    if constexpr (IsRangeBody<Func>) {
+      if (Current_ != end) {
+        Func_(Current_, end);
+        Current_ = end;
+      }
+    } else {
+      for (; Current_ != end; ++Current_) {
+        Func_(Current_);
+      }
+    }
+  }
+
+  // Gives the second half of the remaining range to a balancing task.
+  void SplitHalf() {
+    size_t mid = Current_ + (End_ - Current_) / 2;
+    // eigen's scheduler will push task to the current thread queue,
+    // then some other thread can steal this
+    IntrusivePtr<TaskNode> nodePtr{new TaskNode{CurrentNode_}};
+    Sched_.run(Task<Sharing::DISABLED, Balancing::STATIC, Func, SplittingPolicy>{ // already shared and counted grainsize
+        Sched_, std::move(nodePtr), mid, End_, Func_,
+        SplitData{.GrainSize = Split_.GrainSize, .Depth = Split_.Depth + 1,
+                  .Priority = Split_.Priority}},
+        Split_.Priority);
+    End_ = mid;
+  }
+
+  // Executes the range and promotes its second half to a balancing task on
+  // every heartbeat of the worker. The clock is polled every `stride`
+  // iterations, the stride adapts so that a heartbeat takes a few polls.
+  void ExecuteHeartbeat() {
+    constexpr Timestamp PollsPerHeartbeat = 8;
+    const auto interval = detail::HeartbeatInterval(Sched_.arena());
+    auto &lastBeat = detail::LastHeartbeat();
+    size_t stride = Split_.GrainSize;
+    auto polled = Now();
+    while (Current_ != End_ && !IsCancelled()) {
+      ExecuteRange(std::min(End_, Current_ + stride));
+      auto now = Now();
+      if (now - polled < interval / PollsPerHeartbeat) {
+        stride *= 2;
+      } else if (stride > Split_.GrainSize) {
+        stride /= 2;
+      }
+      polled = now;
+      if (now - lastBeat >= interval) {
+        lastBeat = now;
+        if (Current_ != End_ && IsDivisible()) {
+          SplitHalf();
+        }
+      }
+    }
+  }
+
+  // Executes iterations for the initial timespan, the number of executed
+  // iterations becomes the grain size of balancing tasks. Once the cost of
+  // an iteration of this loop body is known from previous calls, the grain
+  // size is seeded from it instead: only a short sample is timed to keep the
+  // cost up to date, and balancing tasks are split off right away.
+  void ExecuteTimespan() {
+    constexpr size_t SamplesPerTimespan = 8;
+    const auto initTime = detail::InitTime(Sched_.arena());
+    auto &cost = detail::IterationCost<Func>();
+    const double knownCost = cost.load(std::memory_order_relaxed);
+    if (knownCost > 0) {
+      Split_.GrainSize =
+          std::max(static_cast<size_t>(initTime / knownCost), size_t{1});
+      if (Current_ != End_ && !IsCancelled()) {
+        auto from = Current_;
+        auto start = Now();
+        ExecuteRange(std::min(
+            End_, Current_ + std::max(Split_.GrainSize / SamplesPerTimespan,
+                                      size_t{1})));
+        UpdateCost(cost, knownCost, Now() - start, Current_ - from);
+      }
+      return;
+    }
+
+    size_t executed = 0;
+    auto start = Now();
+    auto elapsed = Timestamp{0};
+    while (Current_ < End_ && !IsCancelled()) {
+      ExecuteRange(Current_ + 1);
+      ++executed;
+      elapsed = Now() - start;
+      if (elapsed > initTime) {
+        break;
+      }
+    }
+    Split_.GrainSize = std::max(executed, size_t{1});
+    UpdateCost(cost, knownCost, elapsed, executed);
+  }
+
+  static void UpdateCost(std::atomic<double> &cost, double knownCost,
+                         Timestamp elapsed, size_t executed) {
+    if (executed != 0) {
+      // exponential moving average, races between tasks only lose samples
+      double measured = static_cast<double>(elapsed) / executed;
+      cost.store(knownCost > 0 ? (3 * knownCost + measured) / 4 : measured,
+                 std::memory_order_relaxed);
+    }
   }
 
   Scheduler &Sched_;
@@ -235,10 +488,71 @@ private:
   // ThreadId SupposedThread_;
 
   IntrusivePtr<TaskNode> CurrentNode_;
+  // token of the loop, cached off the node, nullptr if it can't be cancelled
+  const CancellationToken *Token_;
 };
 
+} // namespace EigenPartitioner
+
+// Task only holds a reference, indices, a node pointer and the user functor,
+// so it can be kept inline in the queue slots if the functor allows that.
+template <EigenPartitioner::Sharing S, EigenPartitioner::Balancing B,
+          typename F, EigenPartitioner::Splitting L>
+struct Eigen::IsTriviallyRelocatable<EigenPartitioner::Task<S, B, F, L>>
+    : Eigen::IsTriviallyRelocatable<std::decay_t<F>> {};
+
+namespace EigenPartitioner {
+
 namespace detail {
 
+// Waits until the caller holds the only reference to the root node, i.e. all
+// tasks of the loop are done. Pool workers help to execute tasks meanwhile,
+// other threads spin for the pool spin budget and then block on a futex.
+// A thread that runs a task of another arena doesn't block, it helps as a
+// guest: if all workers of two arenas waited for each other's nested loops,
+// nobody would run them.
+// Worker 0 of the default arena is the main thread, which may be busy
+// outside of the pool (e.g. joining the caller), so callers of such a pool
+// also run its tasks as guests while they spin, and block only when there
+// is nothing to steal. If the main thread is the only worker, nobody is
+// bound to run tasks pushed after that (splits of a chunk another guest
+// took), so the caller keeps checking for them instead of blocking.
+inline void Join(EigenPoolWrapper &sched, TaskNode &rootNode) {
+  if (sched.is_worker()) {
+    while (IntrusivePtrLoadRef(&rootNode) != 1) {
+      sched.execute_something_else();
+    }
+    return;
+  }
+  if (!ThreadLocalTaskStack().IsEmpty()) {
+    while (IntrusivePtrLoadRef(&rootNode) != 1) {
+      if (is_stack_half_full() || !sched.execute_as_guest()) {
+        CpuRelax();
+      }
+    }
+    return;
+  }
+  const bool help = sched.uses_main_thread();
+  const auto spins = sched.spin_count();
+  for (unsigned i = 0; i != spins && IntrusivePtrLoadRef(&rootNode) != 1;
+       ++i) {
+    if (help && sched.execute_as_guest()) {
+      i = 0;
+    } else {
+      CpuRelax();
+    }
+  }
+  if (help && sched.num_threads() == 1) {
+    while (IntrusivePtrLoadRef(&rootNode) != 1) {
+      if (!sched.execute_as_guest()) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    }
+    return;
+  }
+  IntrusivePtrWaitUnique(&rootNode);
+}
+
 template <typename F>
 auto WrapAsTask(F&& func, const IntrusivePtr<TaskNode>& node) {
   return [&func, ref = node]() {
@@ -250,23 +564,131 @@ auto WrapAsTask(F&& func, const IntrusivePtr<TaskNode>& node) {
     threadTaskStack.Pop();
   };
 }
+
+// Same as WrapAsTask, but the task owns the functor: it may run after the
+// spawning frame is gone.
+template <typename F>
+auto WrapAsOwningTask(F &&func, const IntrusivePtr<TaskNode> &node) {
+  return [func = std::forward<F>(func), ref = node]() mutable {
+    TaskStack ts;
+    auto &threadTaskStack = ThreadLocalTaskStack();
+    threadTaskStack.Add(ts);
+
+    func();
+    threadTaskStack.Pop();
+  };
+}
 }
 
+// Runs fst as a task of the given priority and sec on the calling thread.
 template <typename F1, typename F2>
-void ParallelDo(F1&& fst, F2&& sec) {
+void ParallelDo(F1&& fst, F2&& sec,
+                Eigen::Priority priority = Eigen::Priority::NORMAL) {
   EigenPoolWrapper sched;
   // allocating only for top-level nodes
   TaskNode rootNode;
   IntrusivePtrAddRef(&rootNode); // avoid deletion
 
-  sched.run(detail::WrapAsTask(std::forward<F1>(fst), IntrusivePtr{&rootNode}));
+  sched.run(detail::WrapAsTask(std::forward<F1>(fst), IntrusivePtr{&rootNode}),
+            priority);
   std::forward<F2>(sec)();
 
-  while (IntrusivePtrLoadRef(&rootNode) != 1) {
-    sched.execute_something_else();
+  detail::Join(sched, rootNode);
+}
+
+namespace detail {
+
+// Spawned branch of Spawn. The frame lives on the stack of the spawning
+// thread, the frame deque of the pool only holds a pointer to it.
+template <typename F>
+struct SpawnFrame : Eigen::SpawnedFrame {
+  explicit SpawnFrame(F &func) : Eigen::SpawnedFrame{&Steal}, Func(func) {}
+
+  // runs on a thief
+  static void Steal(Eigen::SpawnedFrame *base) {
+    auto *frame = static_cast<SpawnFrame *>(base);
+    TaskStack ts;
+    auto &threadTaskStack = ThreadLocalTaskStack();
+    threadTaskStack.Add(ts);
+    frame->Func();
+    threadTaskStack.Pop();
+    // the spawner may return and destroy the frame right after this store
+    frame->Done.store(true, std::memory_order_release);
+  }
+
+  F &Func;
+  std::atomic<bool> Done{false};
+};
+
+} // namespace detail
+
+// Same as ParallelDo, but nothing is allocated: fst stays in the frame of
+// the caller and the frame deque of the worker holds a pointer to it. The
+// caller runs sec and then pops its frame back, so unless fst was stolen it
+// runs right there, and only a stolen frame is waited for. Threads outside
+// of the pool fall back to ParallelDo, a pool of one thread runs both
+// serially.
+template <typename F1, typename F2> void Spawn(F1 &&fst, F2 &&sec) {
+  EigenPoolWrapper sched;
+  if (!sched.is_worker()) {
+    ParallelDo(std::forward<F1>(fst), std::forward<F2>(sec));
+    return;
+  }
+  if (sched.num_threads() == 1) {
+    fst();
+    sec();
+    return;
+  }
+  detail::SpawnFrame<std::remove_reference_t<F1>> frame{fst};
+  if (!sched.push_frame(&frame)) [[unlikely]] {
+    // too deep, there is enough work to steal from older frames
+    fst();
+    sec();
+    return;
+  }
+  std::forward<F2>(sec)();
+  if (sched.pop_frame() == &frame) {
+    fst();
+    return;
+  }
+  while (!frame.Done.load(std::memory_order_acquire)) {
+    if (!sched.execute_something_else()) {
+      CpuRelax();
+    }
   }
 }
 
+// Tasks that are waited for together, e.g. children of a divide and conquer
+// step: run() schedules a task, wait() returns once all tasks run so far are
+// done. Every task holds a reference to the root node of the group, so its
+// reference count is the only completion counter, and waiting is the same as
+// in ParallelDo. The destructor waits too.
+class TaskGroup {
+public:
+  explicit TaskGroup(Eigen::Priority priority = Eigen::Priority::NORMAL)
+      : Priority_(priority) {
+    IntrusivePtrAddRef(&RootNode_); // avoid deletion
+  }
+
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+
+  ~TaskGroup() { wait(); }
+
+  template <typename F> void run(F &&func) {
+    Sched_.run(detail::WrapAsOwningTask(std::forward<F>(func),
+                                        IntrusivePtr{&RootNode_}),
+               Priority_);
+  }
+
+  void wait() { detail::Join(Sched_, RootNode_); }
+
+private:
+  EigenPoolWrapper Sched_;
+  TaskNode RootNode_;
+  Eigen::Priority Priority_;
+};
+
 namespace detail {
 
 template <int Mode>
@@ -276,67 +698,179 @@ template <>
 struct ParForTraits<EIGEN_STEALING> {
   static constexpr Balancing BalancingPolicy = Balancing::STATIC;
   static constexpr Sharing SharingPolicy = Sharing::DISABLED;
+  static constexpr Splitting SplittingPolicy = Splitting::EAGER;
 };
 
 template <>
 struct ParForTraits<EIGEN_SHARING> {
   static constexpr Balancing BalancingPolicy = Balancing::STATIC;
   static constexpr Sharing SharingPolicy = Sharing::ENABLED;
+  static constexpr Splitting SplittingPolicy = Splitting::EAGER;
 };
 
 template <>
 struct ParForTraits<EIGEN_STEALING_GRAINSIZE> {
   static constexpr Balancing BalancingPolicy = Balancing::TIMESPAN;
   static constexpr Sharing SharingPolicy = Sharing::DISABLED;
+  static constexpr Splitting SplittingPolicy = Splitting::EAGER;
 };
 
 template <>
 struct ParForTraits<EIGEN_SHARING_STEALING> {
   static constexpr Balancing BalancingPolicy = Balancing::TIMESPAN;
   static constexpr Sharing SharingPolicy = Sharing::ENABLED;
+  static constexpr Splitting SplittingPolicy = Splitting::EAGER;
+};
+
+template <>
+struct ParForTraits<EIGEN_SHARING_LAZY> {
+  static constexpr Balancing BalancingPolicy = Balancing::TIMESPAN;
+  static constexpr Sharing SharingPolicy = Sharing::ENABLED;
+  static constexpr Splitting SplittingPolicy = Splitting::LAZY;
+};
+
+template <>
+struct ParForTraits<EIGEN_HEARTBEAT> {
+  static constexpr Balancing BalancingPolicy = Balancing::STATIC;
+  static constexpr Sharing SharingPolicy = Sharing::ENABLED;
+  static constexpr Splitting SplittingPolicy = Splitting::HEARTBEAT;
 };
 
 
 } // namespace detail
 
 template <int Mode, typename F>
-void ParallelFor(size_t from, size_t to, F&& func, size_t grainsize) {
+void ParallelFor(EigenArena &arena, size_t from, size_t to, F &&func,
+                 size_t grainsize,
+                 Eigen::Priority priority = Eigen::Priority::NORMAL,
+                 const CancellationToken *token = nullptr) {
   using Traits = detail::ParForTraits<Mode>;
-  EigenPoolWrapper sched;
+  if constexpr (Traits::BalancingPolicy == Balancing::TIMESPAN) {
+    // calibrate (if needed) before any task of the loop can wait for it
+    detail::InitTime(arena);
+  }
+  if constexpr (Traits::SplittingPolicy == Splitting::HEARTBEAT) {
+    detail::HeartbeatInterval(arena);
+  }
+  EigenPoolWrapper sched(arena);
   // allocating only for top-level nodes
   TaskNode rootNode;
   IntrusivePtrAddRef(&rootNode); // avoid deletion
+  rootNode.Token = token;
   SplitData splitData{
-    .Threads = {0, static_cast<size_t>(GetNumThreads())},
+    .Threads = {0, sched.num_threads()},
     .GrainSize = grainsize,
+    .Priority = priority,
+  };
+  auto start = [&](auto &&task) {
+    if (sched.is_worker() || sched.uses_main_thread()) {
+      task();
+    } else {
+      // the arena has no slot for this thread, run the loop on its workers
+      sched.run_on_thread(std::move(task), 0, priority);
+    }
   };
   if (detail::ThreadLocalTaskStack().IsEmpty()) {
-    Task<Traits::SharingPolicy, Traits::BalancingPolicy, F> task{
+    start(Task<Traits::SharingPolicy, Traits::BalancingPolicy, F,
+               Traits::SplittingPolicy>{
         sched,
         IntrusivePtr<TaskNode>(&rootNode),
         from, to,
         std::forward<F>(func),
-        splitData};
-    task();
+        splitData});
   } else {
-    Task<Sharing::DISABLED, Traits::BalancingPolicy, F> task{
+    start(Task<Sharing::DISABLED, Traits::BalancingPolicy, F,
+               Traits::SplittingPolicy>{
         sched,
         IntrusivePtr<TaskNode>(&rootNode),
         from, to,
         std::forward<F>(func),
-        splitData};
-    task();
+        splitData});
   }
 
-  while (IntrusivePtrLoadRef(&rootNode) != 1) {
-    sched.execute_something_else();
-  }
+  detail::Join(sched, rootNode);
+}
+
+template <int Mode, typename F>
+void ParallelFor(size_t from, size_t to, F&& func, size_t grainsize,
+                 Eigen::Priority priority = Eigen::Priority::NORMAL) {
+  ParallelFor<Mode>(EigenArena::Default(), from, to, std::forward<F>(func),
+                    grainsize, priority);
+}
+
+template <typename Func>
+void ParallelFor(EigenArena &arena, size_t from, size_t to, Func &&func,
+                 size_t grainsize = 1,
+                 Eigen::Priority priority = Eigen::Priority::NORMAL) {
+  grainsize = std::max(grainsize, size_t{1});
+  return ParallelFor<EIGEN_MODE>(arena, from, to, std::forward<Func>(func),
+                                 grainsize, priority);
+}
+
+template <typename Func>
+void ParallelFor(size_t from, size_t to, Func&& func, size_t grainsize = 1,
+                 Eigen::Priority priority = Eigen::Priority::NORMAL) {
+  grainsize = std::max(grainsize, size_t{1});
+  return ParallelFor<EIGEN_MODE>(from, to, std::forward<Func>(func), grainsize,
+                                 priority);
 }
 
+// Same as ParallelFor, but func is called with chunks [begin, end) of
+// contiguous indices, so the body can vectorize across iterations.
 template <typename Func>
-void ParallelFor(size_t from, size_t to, Func&& func, size_t grainsize = 1) {
+void ParallelForRange(size_t from, size_t to, Func &&func,
+                      size_t grainsize = 1) {
+  static_assert(IsRangeBody<std::decay_t<Func>>,
+                "ParallelForRange body must be callable as func(begin, end)");
   grainsize = std::max(grainsize, size_t{1});
-  return ParallelFor<EIGEN_MODE>(from, to, std::forward<Func>(func), grainsize);
+  return ParallelFor<EIGEN_MODE>(from, to, std::forward<Func>(func), grainsize,
+                                 Eigen::Priority::NORMAL);
+}
+
+// Same as ParallelFor, but chunks that haven't started when the token gets
+// cancelled are skipped.
+template <typename Func>
+void ParallelFor(const CancellationToken &token, size_t from, size_t to,
+                 Func &&func, size_t grainsize = 1) {
+  grainsize = std::max(grainsize, size_t{1});
+  return ParallelFor<EIGEN_MODE>(EigenArena::Default(), from, to,
+                                 std::forward<Func>(func), grainsize,
+                                 Eigen::Priority::NORMAL, &token);
+}
+
+// Returns the smallest index in [from, to) that satisfies pred, or to if
+// there is none. A match cancels all iterations after it, earlier ones still
+// run.
+template <typename Pred>
+size_t ParallelFindFirst(size_t from, size_t to, Pred &&pred,
+                         size_t grainsize = 1) {
+  CancellationToken token;
+  ParallelFor(
+      token, from, to,
+      [&](size_t i) {
+        if (pred(i)) {
+          token.CancelFrom(i + 1);
+        }
+      },
+      grainsize);
+  // the limit is one past the first match
+  return std::min(token.Limit(), to + 1) - 1;
+}
+
+// Returns true if some index in [from, to) satisfies pred, the first match
+// cancels all remaining iterations.
+template <typename Pred>
+bool ParallelAnyOf(size_t from, size_t to, Pred &&pred, size_t grainsize = 1) {
+  CancellationToken token;
+  ParallelFor(
+      token, from, to,
+      [&](size_t i) {
+        if (pred(i)) {
+          token.Cancel();
+        }
+      },
+      grainsize);
+  return token.IsCancelled(from);
 }
 
 } // namespace EigenPartitioner
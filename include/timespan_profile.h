@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Timespan profile keeps the initial timespan of TIMESPAN balancing (cycles a
+// task runs before it starts to split, see EigenPartitioner::Task) per
+// machine and number of threads. timespan_tuner measures it and saves it,
+// the partitioner loads it at startup.
+//
+// The profile is a text file with "<machine>\t<threads>\t<cycles>" lines,
+// "timespan_profile.txt" in the working directory by default or the file
+// from BENCH_TIMESPAN_PROFILE.
+inline std::filesystem::path TimespanProfilePath() {
+  if (const char *envPath = std::getenv("BENCH_TIMESPAN_PROFILE")) {
+    return envPath;
+  }
+  return "timespan_profile.txt";
+}
+
+// "<hostname>/<cpu model>", tabs are replaced to keep the file format.
+inline std::string MachineName() {
+  char host[256] = {};
+  gethostname(host, sizeof(host) - 1);
+  std::string model;
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (model.empty() && std::getline(cpuinfo, line)) {
+    // "model name" on x86, "CPU part" on aarch64
+    if (line.rfind("model name", 0) == 0 || line.rfind("CPU part", 0) == 0) {
+      auto colon = line.find(':');
+      model = colon == std::string::npos ? line : line.substr(colon + 1);
+      model.erase(0, model.find_first_not_of(' '));
+    }
+  }
+  auto name = std::string(host) + "/" + model;
+  for (auto &c : name) {
+    if (c == '\t' || c == '\n') {
+      c = ' ';
+    }
+  }
+  return name;
+}
+
+// Initial timespan (in Now() ticks) when the profile has no entry and it
+// can't be calibrated either: a pool with no other worker to share a task
+// with. Typical values measured by timespan_tuner on a server.
+inline constexpr uint64_t DefaultTimespan() {
+#if defined(__aarch64__)
+  return 1800;
+#else
+  return 16500;
+#endif
+}
+
+namespace detail {
+
+struct TimespanProfileEntry {
+  std::string Machine;
+  size_t Threads = 0;
+  uint64_t Cycles = 0;
+};
+
+inline std::vector<TimespanProfileEntry>
+ReadTimespanProfile(const std::filesystem::path &path) {
+  std::vector<TimespanProfileEntry> entries;
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    auto tab = line.find('\t');
+    if (tab == std::string::npos) {
+      continue;
+    }
+    TimespanProfileEntry entry;
+    entry.Machine = line.substr(0, tab);
+    std::istringstream numbers(line.substr(tab + 1));
+    if (numbers >> entry.Threads >> entry.Cycles) {
+      entries.push_back(entry);
+    }
+  }
+  return entries;
+}
+
+} // namespace detail
+
+inline std::optional<uint64_t>
+LoadTimespanProfile(const std::filesystem::path &path,
+                    const std::string &machine, size_t threads) {
+  for (auto &entry : detail::ReadTimespanProfile(path)) {
+    if (entry.Machine == machine && entry.Threads == threads) {
+      return entry.Cycles;
+    }
+  }
+  return std::nullopt;
+}
+
+// Adds or replaces the entry of the machine and the number of threads,
+// entries of other machines are kept.
+inline bool SaveTimespanProfile(const std::filesystem::path &path,
+                                const std::string &machine, size_t threads,
+                                uint64_t cycles) {
+  auto entries = detail::ReadTimespanProfile(path);
+  bool found = false;
+  for (auto &entry : entries) {
+    if (entry.Machine == machine && entry.Threads == threads) {
+      entry.Cycles = cycles;
+      found = true;
+    }
+  }
+  if (!found) {
+    entries.push_back({machine, threads, cycles});
+  }
+  std::ofstream out(path, std::ios::trunc);
+  for (auto &entry : entries) {
+    out << entry.Machine << '\t' << entry.Threads << '\t' << entry.Cycles
+        << '\n';
+  }
+  return static_cast<bool>(out);
+}
@@ -0,0 +1,334 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <sched.h>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Machine topology as seen by this process, read from /sys/devices/system
+// and the cgroup cpu controller (hwloc is not used to keep the benchmarks
+// dependency free). Only cpus of the process affinity mask are reported.
+// They are ordered by package, NUMA node and last level cache, and inside
+// a cache first threads of all cores go, then their SMT siblings. Worker i is
+// pinned to Cpus[i] (see PinThread), so every package, NUMA or last level
+// cache domain is a contiguous range of worker indices, and the first
+// workers of a domain don't share cores. L2 domains are contiguous only
+// within one SMT rank: cores of an L2 cluster are neighbours, while SMT
+// siblings that share the L2 of their core are NumCores apart.
+struct CpuInfo {
+  int Id = 0;
+  int Package = 0;
+  int Node = 0;
+  int Core = 0;    // core id, unique within the package
+  int SmtRank = 0; // index among SMT siblings of the core
+  int L2 = -1;     // domain id: first cpu sharing the L2 cache
+  int Llc = -1;    // domain id: first cpu sharing the last level cache
+};
+
+struct Topology {
+  std::vector<CpuInfo> Cpus;
+  // cpus available by cgroup quota (cpu.max or cfs_quota_us / cfs_period_us),
+  // 0 if there is no quota
+  double CpuQuota = 0;
+
+  size_t NumPackages() const { return CountDistinct(&CpuInfo::Package); }
+  size_t NumNodes() const { return CountDistinct(&CpuInfo::Node); }
+  // physical cores, SMT siblings are not counted
+  size_t NumCores() const {
+    size_t cores = 0;
+    for (auto &cpu : Cpus) {
+      cores += cpu.SmtRank == 0;
+    }
+    return cores;
+  }
+
+  // Number of physical cores of the first NUMA node (within the affinity
+  // mask) capped by the cgroup quota. This is the default number of threads
+  // for the benchmarks: no SMT siblings and no remote memory.
+  size_t DefaultNumThreads() const {
+    size_t cores = 0;
+    for (auto &cpu : Cpus) {
+      cores += cpu.SmtRank == 0 && cpu.Node == Cpus.front().Node;
+    }
+    if (CpuQuota > 0) {
+      cores = std::min(cores, static_cast<size_t>(std::ceil(CpuQuota)));
+    }
+    return std::max(cores, size_t{1});
+  }
+
+  static const Topology &Get();
+
+private:
+  size_t CountDistinct(int CpuInfo::*field) const {
+    std::vector<int> values;
+    for (auto &cpu : Cpus) {
+      values.push_back(cpu.*field);
+    }
+    std::sort(values.begin(), values.end());
+    return std::unique(values.begin(), values.end()) - values.begin();
+  }
+};
+
+namespace detail {
+
+// Order of Topology::Cpus, see above.
+inline void SortCpus(std::vector<CpuInfo> &cpus) {
+  std::stable_sort(cpus.begin(), cpus.end(),
+                   [](const CpuInfo &lhs, const CpuInfo &rhs) {
+                     return std::tie(lhs.Package, lhs.Node, lhs.Llc,
+                                     lhs.SmtRank, lhs.L2, lhs.Core, lhs.Id) <
+                            std::tie(rhs.Package, rhs.Node, rhs.Llc,
+                                     rhs.SmtRank, rhs.L2, rhs.Core, rhs.Id);
+                   });
+}
+
+inline const std::filesystem::path SysCpuDir = "/sys/devices/system/cpu";
+inline const std::filesystem::path SysNodeDir = "/sys/devices/system/node";
+
+inline std::string ReadLine(const std::filesystem::path &path) {
+  std::ifstream in(path);
+  std::string line;
+  std::getline(in, line);
+  return line;
+}
+
+// Parses lists like "0-3,8,10-11".
+inline std::vector<int> ParseCpuList(const std::string &list) {
+  std::vector<int> result;
+  size_t pos = 0;
+  while (pos < list.size()) {
+    auto end = list.find(',', pos);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    auto item = list.substr(pos, end - pos);
+    if (!item.empty()) {
+      auto dash = item.find('-');
+      int from = std::stoi(item.substr(0, dash));
+      int to = dash == std::string::npos ? from : std::stoi(item.substr(dash + 1));
+      for (int cpu = from; cpu <= to; ++cpu) {
+        result.push_back(cpu);
+      }
+    }
+    pos = end + 1;
+  }
+  return result;
+}
+
+inline std::vector<int> AllowedCpus() {
+  std::vector<int> cpus;
+  cpu_set_t mask;
+  if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+      if (CPU_ISSET(i, &mask)) {
+        cpus.push_back(i);
+      }
+    }
+  }
+  if (cpus.empty()) {
+    for (int i = 0; i < static_cast<int>(std::thread::hardware_concurrency()); ++i) {
+      cpus.push_back(i);
+    }
+  }
+  return cpus;
+}
+
+// Reads cache domains of the cpu, missing entries keep their defaults.
+inline void ReadCaches(CpuInfo &cpu) {
+  std::error_code ec;
+  auto cacheDir = SysCpuDir / ("cpu" + std::to_string(cpu.Id)) / "cache";
+  int llcLevel = 0;
+  for (auto &entry : std::filesystem::directory_iterator(cacheDir, ec)) {
+    if (entry.path().filename().string().rfind("index", 0) != 0) {
+      continue;
+    }
+    if (ReadLine(entry.path() / "type") == "Instruction") {
+      continue;
+    }
+    auto level = ReadLine(entry.path() / "level");
+    auto shared = ParseCpuList(ReadLine(entry.path() / "shared_cpu_list"));
+    if (level.empty() || shared.empty()) {
+      continue;
+    }
+    auto domain = *std::min_element(shared.begin(), shared.end());
+    if (std::stoi(level) == 2) {
+      cpu.L2 = domain;
+    }
+    if (std::stoi(level) >= llcLevel) {
+      llcLevel = std::stoi(level);
+      cpu.Llc = domain;
+    }
+  }
+}
+
+// Reads package, core and SMT siblings of the cpu.
+inline void ReadCore(CpuInfo &cpu) {
+  auto topologyDir = SysCpuDir / ("cpu" + std::to_string(cpu.Id)) / "topology";
+  if (auto package = ReadLine(topologyDir / "physical_package_id");
+      !package.empty()) {
+    cpu.Package = std::stoi(package);
+  }
+  if (auto core = ReadLine(topologyDir / "core_id"); !core.empty()) {
+    cpu.Core = std::stoi(core);
+  }
+  auto siblings = ParseCpuList(ReadLine(topologyDir / "thread_siblings_list"));
+  std::sort(siblings.begin(), siblings.end());
+  auto it = std::find(siblings.begin(), siblings.end(), cpu.Id);
+  cpu.SmtRank = it == siblings.end() ? 0 : it - siblings.begin();
+}
+
+// Returns number of cpus allowed by the cgroup (v2 or v1) quota, 0 if
+// there is no quota.
+inline double ReadCpuQuota() {
+  std::string cgroup;
+  {
+    // "0::/path" for cgroup v2, "N:cpu,cpuacct:/path" for v1
+    std::ifstream in("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(in, line)) {
+      if (line.rfind("0::", 0) == 0) {
+        cgroup = line.substr(3);
+      }
+    }
+  }
+  const std::filesystem::path root = "/sys/fs/cgroup";
+  for (auto dir : {root / cgroup.substr(cgroup.empty() ? 0 : 1), root}) {
+    // "max 100000" or "<quota> <period>"
+    auto max = ReadLine(dir / "cpu.max");
+    if (auto space = max.find(' '); space != std::string::npos) {
+      if (max.substr(0, space) == "max") {
+        return 0;
+      }
+      return std::stod(max.substr(0, space)) / std::stod(max.substr(space + 1));
+    }
+  }
+  for (auto dir : {root / "cpu", root / "cpu,cpuacct"}) {
+    auto quota = ReadLine(dir / "cpu.cfs_quota_us");
+    auto period = ReadLine(dir / "cpu.cfs_period_us");
+    if (!quota.empty() && !period.empty()) {
+      return std::stod(quota) > 0 ? std::stod(quota) / std::stod(period) : 0;
+    }
+  }
+  return 0;
+}
+
+inline void ReadNodes(std::vector<CpuInfo> &cpus) {
+  std::error_code ec;
+  for (auto &entry : std::filesystem::directory_iterator(SysNodeDir, ec)) {
+    auto name = entry.path().filename().string();
+    if (name.rfind("node", 0) != 0 || name.size() == 4 ||
+        !std::all_of(name.begin() + 4, name.end(),
+                     [](unsigned char c) { return std::isdigit(c); })) {
+      continue;
+    }
+    auto node = std::stoi(name.substr(4));
+    for (auto id : ParseCpuList(ReadLine(entry.path() / "cpulist"))) {
+      for (auto &cpu : cpus) {
+        if (cpu.Id == id) {
+          cpu.Node = node;
+        }
+      }
+    }
+  }
+}
+
+} // namespace detail
+
+inline const Topology &Topology::Get() {
+  // read once: workers change their own affinity when they get pinned
+  static const Topology topology = [] {
+    Topology result;
+    for (auto id : detail::AllowedCpus()) {
+      CpuInfo cpu;
+      cpu.Id = id;
+      cpu.L2 = cpu.Llc = id;
+      detail::ReadCaches(cpu);
+      detail::ReadCore(cpu);
+      result.Cpus.push_back(cpu);
+    }
+    detail::ReadNodes(result.Cpus);
+    detail::SortCpus(result.Cpus);
+    result.CpuQuota = detail::ReadCpuQuota();
+    return result;
+  }();
+  return topology;
+}
+
+using StealDomains = std::vector<std::vector<std::pair<unsigned, unsigned>>>;
+
+// For every of numThreads workers returns [from, to) ranges of workers that
+// share L2, last level cache, NUMA node and package with it, nearest first.
+// Domains that contain only the worker itself or all workers are skipped, so
+// there are at most four levels. Domains are contiguous ranges, so the L2
+// level only groups cores of an L2 cluster: with the order of Topology::Get
+// an SMT sibling that shares nothing but the L2 of its core is outside of
+// the range, and on hosts with a private L2 per core the level is skipped.
+// Such siblings steal from each other at the last level cache.
+// Worker i is expected to run on cpus[i].
+inline StealDomains GetStealDomains(const std::vector<CpuInfo> &cpus,
+                                    size_t numThreads) {
+  StealDomains domains(numThreads);
+  if (numThreads > cpus.size()) {
+    // oversubscribed, some workers are not pinned
+    return domains;
+  }
+  auto sameL2 = [](const CpuInfo &a, const CpuInfo &b) {
+    return a.Package == b.Package && a.Node == b.Node && a.Llc == b.Llc &&
+           a.L2 == b.L2;
+  };
+  auto sameLlc = [](const CpuInfo &a, const CpuInfo &b) {
+    return a.Package == b.Package && a.Node == b.Node && a.Llc == b.Llc;
+  };
+  auto sameNode = [](const CpuInfo &a, const CpuInfo &b) {
+    return a.Package == b.Package && a.Node == b.Node;
+  };
+  auto samePackage = [](const CpuInfo &a, const CpuInfo &b) {
+    return a.Package == b.Package;
+  };
+  auto addLevel = [&](auto &&same) {
+    for (size_t worker = 0; worker != numThreads; ++worker) {
+      size_t from = worker;
+      size_t to = worker + 1;
+      while (from > 0 && same(cpus[from - 1], cpus[worker])) {
+        --from;
+      }
+      while (to < numThreads && same(cpus[to], cpus[worker])) {
+        ++to;
+      }
+      auto &levels = domains[worker];
+      std::pair<unsigned, unsigned> range(from, to);
+      if (to - from == 1 || to - from == numThreads ||
+          (!levels.empty() && levels.back() == range)) {
+        continue;
+      }
+      levels.push_back(range);
+    }
+  };
+  addLevel(sameL2);
+  addLevel(sameLlc);
+  addLevel(sameNode);
+  addLevel(samePackage);
+  return domains;
+}
+
+// Same for workers pinned with PinThread.
+inline StealDomains GetStealDomains(size_t numThreads) {
+  return GetStealDomains(Topology::Get().Cpus, numThreads);
+}
+
+// Pins the calling thread to the cpu with the given id, returns the result
+// of sched_setaffinity.
+inline int PinThreadToCpu(int cpu) {
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  CPU_SET(cpu, &mask);
+  return sched_setaffinity(0, sizeof(mask), &mask);
+}
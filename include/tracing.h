@@ -85,6 +85,10 @@ struct Metrics {
     uint64_t tasks_stolen = 0;
     uint64_t tasks_shared = 0;
     uint64_t tasks_undivided = 0;
+    uint64_t workers_parked = 0;
+    uint64_t tasks_overflowed = 0;
+    uint64_t steal_attempts = 0;
+    uint64_t steal_successes = 0;
 
     static Metrics& this_thread();
 
@@ -106,6 +110,10 @@ struct Metrics {
         tasks_stolen += rhs.tasks_stolen;
         tasks_shared += rhs.tasks_shared;
         tasks_undivided += rhs.tasks_undivided;
+        workers_parked += rhs.workers_parked;
+        tasks_overflowed += rhs.tasks_overflowed;
+        steal_attempts += rhs.steal_attempts;
+        steal_successes += rhs.steal_successes;
         return *this;
     }
 };
@@ -120,6 +128,10 @@ inline std::ostream& operator<<(std::ostream& strm, const Metrics& metrics) {
     PRINT_FIELD(tasks_stolen)
     PRINT_FIELD(tasks_shared)
     PRINT_FIELD(tasks_undivided)
+    PRINT_FIELD(workers_parked)
+    PRINT_FIELD(tasks_overflowed)
+    PRINT_FIELD(steal_attempts)
+    PRINT_FIELD(steal_successes)
 #undef PRINT_FIELD
     strm << "}";
     return strm;
@@ -280,4 +292,20 @@ inline void TaskUndivided() {
     Metrics::this_thread().tasks_undivided++;
 }
 
+inline void WorkerParked() {
+    Metrics::this_thread().workers_parked++;
+}
+
+inline void TaskOverflowed() {
+    Metrics::this_thread().tasks_overflowed++;
+}
+
+inline void StealAttempt() {
+    Metrics::this_thread().steal_attempts++;
+}
+
+inline void StealSuccess() {
+    Metrics::this_thread().steal_successes++;
+}
+
 } // namespace Eigen::Tracing
@@ -1,6 +1,7 @@
 #pragma once
 #include "modes.h"
 #include "num_threads.h"
+#include "topology.h"
 
 #ifdef EIGEN_MODE
 #include "eigen_pool.h"
@@ -59,27 +60,14 @@ inline void CpuRelax() {
 #endif
 }
 
+// Pins the calling thread to the slot_number'th cpu of the process in
+// topology order (see Topology), so neighbouring slots share caches.
 inline void PinThread(size_t slot_number) {
-  cpu_set_t mask;
-  auto mask_size = sizeof(mask);
-  if (sched_getaffinity(0, mask_size, &mask)) {
-    std::cerr << "Error in sched_getaffinity" << std::endl;
+  const auto &cpus = Topology::Get().Cpus;
+  if (slot_number >= cpus.size()) {
     return;
   }
-  // clear all bits in current_affinity except slot_numbers'th non-zero bit
-  size_t nonzero_bits = 0;
-  for (size_t i = 0; i < CPU_SETSIZE; ++i) {
-    if (CPU_ISSET(i, &mask)) {
-      if (nonzero_bits == slot_number) {
-        CPU_ZERO(&mask);
-        CPU_SET(i, &mask);
-        break;
-      }
-      ++nonzero_bits;
-    }
-  }
-
-  if (auto err = sched_setaffinity(0, mask_size, &mask)) {
+  if (auto err = PinThreadToCpu(cpus[slot_number].Id)) {
     std::cerr << "Error in sched_setaffinity, slot_number = " << slot_number
               << ", err = " << err << std::endl;
   }
@@ -1,4 +1,5 @@
 #include "../include/parallel_for.h"
+#include "../include/timespan_profile.h"
 #include <ctime>
 #include <vector>
 
@@ -88,4 +89,16 @@ int main() {
             << maximums.at(PercentileIndex(0.99, maximums.size()))
             << " (maximums) \n";
   std::cout << "Maximum: " << flat_results.back() << " (maximums) \n";
+#if defined(EIGEN_MODE) && EIGEN_MODE == EIGEN_SHARING
+  // 99% of iterations should fit scheduling in the initial timespan of
+  // TIMESPAN balancing
+  auto timespan = maximums.at(PercentileIndex(0.99, maximums.size()));
+  auto path = TimespanProfilePath();
+  if (SaveTimespanProfile(path, MachineName(), threadNum, timespan)) {
+    std::cout << "Timespan profile: " << timespan << " saved to " << path
+              << "\n";
+  } else {
+    std::cout << "Failed to save timespan profile to " << path << "\n";
+  }
+#endif
 }